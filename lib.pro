@@ -0,0 +1,26 @@
+TEMPLATE	= lib
+CONFIG		+= shared
+QT          -= gui core
+CONFIG      += link_pkgconfig
+
+QT_CONFIG -= no-pkg-config
+CONFIG    += link_pkgconfig
+
+PKGCONFIG += opencv
+
+HEADERS		= src/*.h\
+			  src/lib/*.h\
+			  src/gco/*.h\
+			  src/WMF/*.h
+SOURCES		= src/lib/lf2depth_lib.cpp\
+			  src/gco/*.cpp
+
+TARGET		= lf2depth
+INCLUDEPATH +=  /usr/include/hdf5/serial/
+QMAKE_CXXFLAGS += -O3 -march=native -std=c++11 -m64 -pipe -ffast-math -Wall -fpermissive -fopenmp
+LIBS +=    -lhdf5_serial -lz -fopenmp -pthread
+LIBS +=  -L/usr/lib/x86_64-linux-gnu
+LIBS +=  -L/usr/local/lib
+
+OBJECTS_DIR = obj/lib
+DESTDIR     = lib
@@ -18,7 +18,7 @@ TARGET		= lf2depth
 INCLUDEPATH +=  /usr/include/hdf5/serial/
 QMAKE_CXXFLAGS += -O3 -march=native -std=c++11 -m64 -pipe -ffast-math -Waggressive-loop-optimizations -Wall -fpermissive -fopenmp
 linux-g++: QMAKE_CXXFLAGS += -O99 
-LIBS +=    -lhdf5_serial -lz -lX11 -fopenmp
+LIBS +=    -lhdf5_serial -lz -lX11 -fopenmp -pthread -lrt
 LIBS +=  -L/usr/lib/x86_64-linux-gnu
 LIBS +=  -L/usr/local/lib
 
@@ -401,7 +401,7 @@ private:
 	***************************************************************/
 	static inline void updateBCB(int &num,int *f,int *b,int i,int v){
 	
-		static int p1,p2;
+		int p1,p2;
 	
 		if(i){
 			if(!num){ // cell is becoming non-empty
@@ -524,9 +524,7 @@ private:
 
 			const int shift = 2; // 256(8-bit)->64(6-bit)
 			const int LOW_NUM = 256>>shift;
-			static int hash[LOW_NUM][LOW_NUM][LOW_NUM]={0};
-
-			memset(hash,0,sizeof(hash));
+			int (*hash)[LOW_NUM][LOW_NUM] = new int[LOW_NUM][LOW_NUM][LOW_NUM](); // per call, filters may run on several threads
 
 			// throw pixels into a 2D histogram
 			int candCnt = 0;
@@ -594,6 +592,7 @@ private:
 					FNew.ptr<int>()[i] = hash[lowB][lowG][lowR];
 				}
 			}
+			delete []hash;
 
 			// Computer weight map (weight between each pair of feature index)
 			{
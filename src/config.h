@@ -10,6 +10,8 @@
 
 #include "h5_io.h"
 #include "light_field.h"
+#include "lf_container.h"
+#include "cost_cache.h"
 
 using namespace std;
 using namespace cv;
@@ -40,6 +42,7 @@ void config_read(string filename, LF* lf_ptr){
    
     lf_ptr->W = fs["WW"]; lf_ptr->H = fs["HH"];
     lf_ptr->U = fs["AA"]; lf_ptr->V = fs["AA"];
+    lf_ptr->window = fs["WINDOW"].empty() ? 7 : (int) fs["WINDOW"];
     lf_ptr->d_min=fs["DMIN"];
     lf_ptr->d_max=fs["DMAX"];
     lf_ptr->type  = fs["DATASET"];
@@ -47,67 +50,118 @@ void config_read(string filename, LF* lf_ptr){
     lf_ptr->mask = fs["MASK"]; 
     lf_ptr->lambda = fs["LAMBDA"];
     lf_ptr->threshold = fs["THRESHOLD"];    
-    //if (lf_ptr->nlabels==0)
-        lf_ptr->nlabels = fs["NUM_LABELS"]; 
+    lf_ptr->mrf_graph = fs["MRF_GRAPH"].empty() ? 1 : (int) fs["MRF_GRAPH"];
+    lf_ptr->mrf_datacost = fs["MRF_DATACOST"].empty() ? 0 : (int) fs["MRF_DATACOST"];
+    lf_ptr->mrf_pool = fs["MRF_POOL"].empty() ? 1 : (int) fs["MRF_POOL"];
+    lf_ptr->mrf_dynamic = fs["MRF_DYNAMIC"].empty() ? 0 : (int) fs["MRF_DYNAMIC"];
+    lf_ptr->simd = fs["SIMD"].empty() ? 1 : (int) fs["SIMD"];
+    lf_ptr->cost_engine = fs["COST_ENGINE"].empty() ? 0 : (int) fs["COST_ENGINE"]; //2: 8-bit fixed point
+    lf_ptr->pipeline = fs["PIPELINE"].empty() ? 0 : (int) fs["PIPELINE"];
+    lf_ptr->cost_type = fs["COST_TYPE"].empty() ? 0 : (int) fs["COST_TYPE"];
+    lf_ptr->cost_scale = fs["COST_SCALE"].empty() ? 0 : (float) fs["COST_SCALE"];
+    lf_ptr->verify = fs["VERIFY"].empty() ? 0 : (int) fs["VERIFY"];
+    lf_ptr->c2f_step = fs["C2F_STEP"].empty() ? 0 : (int) fs["C2F_STEP"];
+    lf_ptr->c2f_band = fs["C2F_BAND"].empty() ? 0 : (int) fs["C2F_BAND"]; //0: one coarse step
+    lf_ptr->subpixel = fs["SUBPIXEL"].empty() ? 0 : (int) fs["SUBPIXEL"];
+    lf_ptr->color_mode = fs["COLOR_MODE"].empty() ? 0 : (int) fs["COLOR_MODE"]; //1: luminance, 2: opponent
+    lf_ptr->cache_dir = fs["CACHE_DIR"].empty() ? string() : (string) fs["CACHE_DIR"];
+    lf_ptr->nlabels = fs["NUM_LABELS"]; //64 if not set
+    lf_ptr->ctx    = NULL;
+    lf_ptr->lf.map = NULL;
     fs.release();
 }
 
 /**
-    Load light field data and attritubes from HCI data.
+    Copy a block of HCI views (RGB, as read by load_hci_views) into the
+    multiview image (BGR).
+    @raw             nv*nu views of H*W*3 bytes
+    @v0 nv           first view row and number of view rows
+    @u0 nu           first view column and number of view columns
     @lf_ptr          light field strutue pointer 
 */
-void loadh5_mat(LF* lf_ptr){
+void hci_views2mat(const unsigned char* raw, int v0, int nv, int u0, int nu, LF* lf_ptr){
+
+    int cnt=0;
+        for (int v = v0; v< v0+nv; v++)    
+            for (int u = u0; u< u0+nu; u++)
+                for (int j=0; j<lf_ptr->H; j++) { 
+                    Vec3b* dst = lf_ptr->img.ptr<Vec3b>(v*lf_ptr->H+j) + u*lf_ptr->W;
+                    for (int i=0; i<lf_ptr->W; i++) { 
+                        dst[i] = Vec3b( raw[cnt+2],  raw[cnt+1],  raw[cnt]);
+                        cnt=cnt+3;                        
+                    }
+                }
+}
+
+/**
+    Load light field data and attritubes from HCI data. The file is opened once,
+    read-only, and by default only the views the EPI cost reads are loaded with
+    hyperslab reads: the central row and column of views, and the central view
+    of the ground truth and of its mask. The other views of lf_ptr->img are left
+    uninitialized and lf_ptr->lf_raw is NULL.
+    @lf_ptr          light field strutue pointer 
+    @all_views       load every view into lf_ptr->img and lf_ptr->lf_raw (multiview stereo)
+*/
+void loadh5_mat(LF* lf_ptr, bool all_views = false){
     
+    int64 t0 = cv::getTickCount();
+    int W  = lf_ptr->W;
+    int H  = lf_ptr->H;
+    int U  = lf_ptr->U;
+    int V  = lf_ptr->V;
+    int vc = (V-1)/2;
+    int uc = (U-1)/2;
+
     lf_ptr->img = Mat(lf_ptr->H*lf_ptr->U, lf_ptr->W*lf_ptr->V, CV_8UC3);  
     //medianBlur ( lf_ptr->img, lf_ptr->img, 3 );
-    lf_ptr->lf_raw = new unsigned char[lf_ptr->H*lf_ptr->W*3*lf_ptr->V*lf_ptr->U];
+
+    std::unique_lock<std::mutex> h5_lock(h5_mutex());
+    hid_t file_id = H5Fopen(lf_ptr->data_filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
 
     //load camera setup
     lf_ptr->shift       = 0.0;
     lf_ptr->baseline    = 0.0;
     lf_ptr->focalLength = 0.0;       
  
-    load_hdf5_attri(lf_ptr->data_filename.c_str(), lf_ptr->shift, lf_ptr->baseline, lf_ptr->focalLength);
+    load_hdf5_attri(file_id, lf_ptr->shift, lf_ptr->baseline, lf_ptr->focalLength);
     //cout<<shift<<" "<<baseline<<" "<<focalLength<<endl;
     
     //load data
-    load_hci_hdf5(lf_ptr->data_filename.c_str(), "LF", H5T_NATIVE_UCHAR, (uchar*) lf_ptr->lf_raw); 
-    int cnt=0;
-        for (int v = 0; v< lf_ptr->V; v++)    
-            for (int u = 0; u< lf_ptr->U; u++)
-                for (int j=0; j<lf_ptr->H; j++) { 
-                    for (int i=0; i<lf_ptr->W; i++) { 
-                        //int idx = (v*lf_ptr->U+u)*lf_ptr->W*lf_ptr->H*3 + 3*lf_ptr->H*j + 3*i;
-                        lf_ptr->img.at<Vec3b>(v*lf_ptr->H+j,u*lf_ptr->W+i)
-                        = Vec3b( lf_ptr->lf_raw[cnt+2],  lf_ptr->lf_raw[cnt+1],  lf_ptr->lf_raw[cnt]);
-                        cnt=cnt+3;                        
-                    }
-                }
+    if (all_views){
+        lf_ptr->lf_raw = new unsigned char[H*W*3*V*U];
+        load_hci_views(file_id, "LF", H5T_NATIVE_UCHAR, 0, V, 0, U, (uchar*) lf_ptr->lf_raw);
+        hci_views2mat(lf_ptr->lf_raw, 0, V, 0, U, lf_ptr);
+    }
+    else{
+        //central row of views, then central column of views
+        lf_ptr->lf_raw = NULL;
+        unsigned char* cross = new unsigned char[H*W*3*max(U, V)];
+        load_hci_views(file_id, "LF", H5T_NATIVE_UCHAR, vc, 1, 0, U, cross);
+        hci_views2mat(cross, vc, 1, 0, U, lf_ptr);
+        load_hci_views(file_id, "LF", H5T_NATIVE_UCHAR, 0, V, uc, 1, cross);
+        hci_views2mat(cross, 0, V, uc, 1, lf_ptr);
+        delete[] cross;
+    }
 
-    //load the ground truth           
+    //load the ground truth of the central view
     lf_ptr->disparity_gt = Mat(lf_ptr->H,lf_ptr->W,CV_32F);         
-    float* lf_gt= new float[lf_ptr->H*lf_ptr->W*lf_ptr->V*lf_ptr->U];            
-    load_hci_hdf5(lf_ptr->data_filename.c_str(), "GT_DEPTH", H5T_NATIVE_FLOAT, (float*) lf_gt);  
-    //take the central view depth            
+    float* lf_gt= new float[lf_ptr->H*lf_ptr->W];            
+    load_hci_views(file_id, "GT_DEPTH", H5T_NATIVE_FLOAT, vc, 1, uc, 1, lf_gt);
     for (int j=0; j<lf_ptr->H; j++) 
-       for (int i = 0; i < lf_ptr->W; i++){                
-          int idx =((lf_ptr->V*lf_ptr->U-1)/2)*lf_ptr->W*lf_ptr->H + lf_ptr->W*j+i;           
-          lf_ptr->disparity_gt.at<float>(j,i) = lf_ptr->baseline * lf_ptr->focalLength / lf_gt[idx] - lf_ptr->shift;
-        }
+       for (int i = 0; i < lf_ptr->W; i++)
+          lf_ptr->disparity_gt.at<float>(j,i) = lf_ptr->baseline * lf_ptr->focalLength / lf_gt[lf_ptr->W*j+i] - lf_ptr->shift;
     //cout<<"========================"<<endl;
     
     //load the mask if avaliable
     if (lf_ptr->mask==1){
-        float* lf_mask= new float[lf_ptr->H*lf_ptr->W*lf_ptr->V*lf_ptr->U];            
-        load_hci_hdf5(lf_ptr->data_filename.c_str(), "GT_DEPTH_MASK", H5T_NATIVE_FLOAT, (float*) lf_mask);  
-        //take the central view depth            
+        load_hci_views(file_id, "GT_DEPTH_MASK", H5T_NATIVE_FLOAT, vc, 1, uc, 1, lf_gt);
         for (int j=0; j<lf_ptr->H; j++) 
-           for (int i = 0; i < lf_ptr->W; i++){                
-              int idx =((lf_ptr->V*lf_ptr->U-1)/2)*lf_ptr->W*lf_ptr->H + lf_ptr->W*j+i;           
-              lf_ptr->disparity_mask.at<float>(j,i) = lf_mask[idx];
-            }
-        delete[] lf_mask;         
+           for (int i = 0; i < lf_ptr->W; i++)
+              lf_ptr->disparity_mask.at<float>(j,i) = lf_gt[lf_ptr->W*j+i];
     }    
+    H5Fclose(file_id);
+    h5_lock.unlock();
+    cout<<" Loading HDF5 ("<<(all_views ? U*V : U+V-1)<<" views) Done "<<(cv::getTickCount()-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
         
    //Clamp disparity to global range 
         for (int j=0; j<lf_ptr->H; j++) { 
@@ -149,6 +203,68 @@ void loadh5_mat(LF* lf_ptr){
     delete[] lf_gt;        
 }
 
+/**
+    Allocate the result maps of a scene.
+    @lf_ptr          light field strutue pointer 
+*/
+void lf_init_maps(LF* lf_ptr){
+
+    lf_ptr->depth         =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
+    lf_ptr->depth_f       =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
+    lf_ptr->depth_x       =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);
+    lf_ptr->depth_y       =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);
+    lf_ptr->confidence    =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
+    lf_ptr->confidence_x  =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);
+    lf_ptr->confidence_y  =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);  
+
+    if (lf_ptr->mask==1)
+        lf_ptr->disparity_mask = Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
+    else
+        lf_ptr->disparity_mask = Mat::ones( lf_ptr->H,lf_ptr->W,CV_32F);  
+}
+
+/**
+    Initialize light field structure and load data.
+    @lf_ptr          light field strutue pointer 
+    @return          false if the input cannot be loaded
+*/
+bool lf_init(LF* lf_ptr){
+
+    lf_init_maps(lf_ptr);
+    lf_init_params(lf_ptr);//the cache probe keys on the settled parameters
+
+    if (lfr_is_container(lf_ptr->data_filename))//native container, already in tensor order
+        return lfr_load(lf_ptr);
+
+    if (cost_cache_probe(lf_ptr))//cost stage cached, the views are not needed
+        return true;
+
+    if (lf_ptr->type==0)//HCI data, central cross of views (loadh5_mat(lf_ptr, true) for lf2depth_stereo)
+        loadh5_mat(lf_ptr);
+    else//Lytro dat   
+        lf_ptr->img=imread(lf_ptr->data_filename.c_str()); 
+      
+    if (lf_ptr->img.empty()){
+        cout<<" Cannot read "<<lf_ptr->data_filename<<endl;
+        return false;
+    }
+    mview2tensor(lf_ptr);//convert multiview to the light field tensor, the EPIs are views into it  
+    return true;
+}
+
+/**
+    Release the input data of a scene.
+    @lf_ptr          light field strutue pointer 
+*/
+void lf_release(LF* lf_ptr){
+
+    if ((lf_ptr->type==0)&&(!lfr_is_container(lf_ptr->data_filename)))
+        delete[] lf_ptr->lf_raw;
+    lf_ptr->lf_raw = NULL;
+    lfr_close(lf_ptr);
+}
+
+
 #endif
 
 
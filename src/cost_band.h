@@ -0,0 +1,218 @@
+//  Coarse-to-fine disparity search: a banded cost volume keeping the full resolution cost
+//  of every pixel only on a narrow label band around its coarse minimum.
+
+#ifndef _COST_BAND
+#define _COST_BAND
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <cfloat>
+#include "light_field.h"
+#include "cost_kernels.h"
+#include "cost_types.h"
+
+using namespace std;
+using namespace cv;
+
+/**
+    Banded cost volume. Pixel idx holds the labels [k0[idx], k0[idx]+len[idx])
+    at cost[offset[idx]...], together with the mean of the pixel and of the
+    previous pixel on its EPI line at the same labels, plus the box filtered
+    cost of the coarse labels 0, step, 2*step... used outside the band.
+*/
+template<typename T>
+struct band_volume{
+
+	int   nlabels;          //full resolution label count
+	int   step;             //coarse label step
+	int   ncoarse;          //number of coarse labels
+	float scale;            //encoding scale of cost and coarse
+
+	vector<int> offset;
+	vector<int> k0;
+	vector<int> len;
+	vector<T>   cost;
+	vector<T>   mean;
+	vector<T>   mean_prev;
+	vector<T>   coarse;     //ncoarse per pixel
+
+	/**
+	    Decoded cost of pixel idx at label k: the band if k is inside it,
+	    the nearest coarse label otherwise.
+	*/
+	float at(int idx, int k) const{
+
+		int b = k - k0[idx];
+		if ((b>=0)&&(b<len[idx]))
+			return cost_codec<T>::decode(cost[offset[idx]+b], scale);
+		int c = (k + step/2)/step;
+		if (c>=ncoarse) c = ncoarse-1;
+		return cost_codec<T>::decode(coarse[idx*ncoarse+c], scale);
+	}
+
+	/**
+	    True if the cost of pixel idx at label k is a full resolution one,
+	    i.e. k is inside the band and at() does not fall back to a coarse cost.
+	*/
+	bool exact(int idx, int k) const{
+
+		int b = k - k0[idx];
+		return (b>=0)&&(b<len[idx]);
+	}
+};
+
+/**
+    Size the per pixel arrays of a banded volume.
+    @vol          banded volume
+    @num_pixels   number of pixels
+    @lf_ptr       light field structure pointer
+*/
+template<typename T>
+void band_init(band_volume<T>& vol, int num_pixels, LF* lf_ptr){
+
+	vol.nlabels = lf_ptr->nlabels;
+	vol.step    = lf_ptr->c2f_step;
+	vol.ncoarse = (vol.nlabels + vol.step - 1)/vol.step;
+	vol.scale   = lf_ptr->q_cost;
+	vol.offset.assign(num_pixels, 0);
+	vol.k0.assign(num_pixels, 0);
+	vol.len.assign(num_pixels, 0);
+	vol.coarse.assign(num_pixels*vol.ncoarse, T());
+}
+
+/**
+    Lay out the bands one after the other once all of them are known.
+    @vol          banded volume
+*/
+template<typename T>
+void band_alloc(band_volume<T>& vol){
+
+	int total = 0;
+	for (size_t idx=0; idx<vol.len.size(); idx++){
+		vol.offset[idx] = total;
+		total += vol.len[idx];
+	}
+	vol.cost.assign(total, T());
+	vol.mean.assign(total, T());
+	vol.mean_prev.assign(total, T());
+}
+
+/**
+    Coarse pass of one EPI line: sweep the coarse labels, keep their box
+    filtered cost and pick the band around the coarse minimum of every pixel.
+    @img          EPI view as input
+    @dc           coarse label to disparity table
+    @sweep        label sweep kernel
+    @scratch      2*img.cols*ncoarse floats
+    @vol          banded volume as output
+    @base         pixel index of the first position of the line
+    @pstride      pixel index step between two positions of the line
+    @lf_ptr       light field structure pointer
+*/
+template<typename T>
+void band_coarse_line(const epi_view& img, const float* dc, label_sweep_fn sweep, float* scratch,
+                      band_volume<T>& vol, int base, int pstride, LF* lf_ptr){
+
+	int cols = img.cols;
+	int nc   = vol.ncoarse;
+	int r    = lf_ptr->window/2;
+	int band = lf_ptr->c2f_band;
+	float* raw   = scratch;
+	float* rmean = scratch + cols*nc;
+
+	sweep(img, dc, nc, raw, rmean);
+
+	for (int p=0; p<cols; p++){
+
+		int idx = base + p*pstride;
+		T* stack = &vol.coarse[idx*nc];
+		int kc = 0;
+
+		if ((p>r)&&(p<(cols-r-1))){
+			float best = FLT_MAX;
+			for (int c=0; c<nc; c++){
+				float v  = raw[(p-1)*nc+c] + raw[p*nc+c] + raw[(p+1)*nc+c];
+				stack[c] = cost_codec<T>::encode(v, vol.scale);
+				if (v<best){
+					best = v;
+					kc   = c;
+				}
+			}
+		}
+		else
+			for (int c=0; c<nc; c++)
+				stack[c] = cost_codec<T>::encode(0, vol.scale);
+
+		int lo = max(0, kc*vol.step - band);
+		int hi = min(vol.nlabels, kc*vol.step + band + 1);
+		vol.k0[idx]  = lo;
+		vol.len[idx] = hi - lo;
+	}
+}
+
+/**
+    Fine pass of one EPI line. Every column is evaluated once on the hull of
+    its own band and the bands of its two neighbours, which holds all labels
+    the box filter and the previous pixel mean need.
+    @img          EPI view as input
+    @disp         full resolution label to disparity table
+    @range        single pixel label range kernel
+    @scratch      2*img.cols*nlabels floats
+    @vol          banded volume as output
+    @base         pixel index of the first position of the line
+    @pstride      pixel index step between two positions of the line
+    @lf_ptr       light field structure pointer
+    @return       number of (pixel, label) cost evaluations
+*/
+template<typename T>
+long band_fine_line(const epi_view& img, const float* disp, label_range_fn range, float* scratch,
+                    band_volume<T>& vol, int base, int pstride, LF* lf_ptr){
+
+	const float* centre = epi_row(img, (img.rows-1)/2);
+	int cols = img.cols;
+	int L    = vol.nlabels;
+	int r    = lf_ptr->window/2;
+	float* raw   = scratch;
+	float* rmean = scratch + cols*L;
+	long evals = 0;
+
+	for (int q=r; q<(cols-r); q++){
+
+		int lo = L, hi = 0;
+		for (int n=max(q-1, 0); n<=min(q+1, cols-1); n++){
+			int idx = base + n*pstride;
+			lo = min(lo, vol.k0[idx]);
+			hi = max(hi, vol.k0[idx] + vol.len[idx]);
+		}
+		range(centre, img.rstride, q, disp, lo, hi, raw + q*L, rmean + q*L);
+		evals += hi - lo;
+	}
+
+	for (int p=0; p<cols; p++){
+
+		int idx = base + p*pstride;
+		int lo  = vol.k0[idx];
+		int n   = vol.len[idx];
+		T* cost      = &vol.cost[vol.offset[idx]];
+		T* mean      = &vol.mean[vol.offset[idx]];
+		T* mean_prev = &vol.mean_prev[vol.offset[idx]];
+
+		if ((p>r)&&(p<(cols-r-1))){
+			for (int b=0; b<n; b++){
+				int k = lo + b;
+				cost[b]      = cost_codec<T>::encode(raw[(p-1)*L+k] + raw[p*L+k] + raw[(p+1)*L+k], vol.scale);
+				mean[b]      = cost_codec<T>::encode(rmean[p*L+k],     lf_ptr->q_mean);
+				mean_prev[b] = cost_codec<T>::encode(rmean[(p-1)*L+k], lf_ptr->q_mean);
+			}
+		}
+		else
+			for (int b=0; b<n; b++){
+				cost[b]      = cost_codec<T>::encode(0, vol.scale);
+				mean[b]      = cost_codec<T>::encode(0, lf_ptr->q_mean);
+				mean_prev[b] = cost_codec<T>::encode(0, lf_ptr->q_mean);
+			}
+	}
+	return evals;
+}
+
+#endif
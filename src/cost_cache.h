@@ -0,0 +1,213 @@
+//  On-disk cache of the merged cost volume and the confidence maps, keyed by the input light
+//  field file and the cost parameters, so the MRF can be tuned without rebuilding the volumes.
+
+#ifndef _COST_CACHE
+#define _COST_CACHE
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "h5_io.h"
+#include "light_field.h"
+#include "cost_types.h"
+
+using namespace std;
+using namespace cv;
+
+/**
+    64-bit FNV-1a hash of a byte buffer.
+    @data         buffer
+    @len          number of bytes
+    @h            hash of the preceding bytes
+*/
+inline uint64_t fnv1a(const void* data, size_t len, uint64_t h = 14695981039346656037ULL){
+
+	const unsigned char* p = (const unsigned char*) data;
+	for (size_t n=0; n<len; n++){
+		h ^= p[n];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/**
+    Cache file of the current scene: CACHE_DIR/<key>.h5, where the key hashes
+    the path, size and modification time of the input file and every parameter
+    the cost stage depends on, so it costs a stat() and not a read of the input.
+    LAMBDA and THRESHOLD are not part of it, they only act after the cache.
+    @lf_ptr       light field structure pointer
+    @type_name    cost volume element type, the float rerun of VERIFY gets its own entry
+    @return       empty if the cache is disabled or the input cannot be stat'ed
+*/
+string cost_cache_path(LF* lf_ptr, const char* type_name){
+
+	struct stat st;
+	if (lf_ptr->cache_dir.empty()||(stat(lf_ptr->data_filename.c_str(), &st)!=0))
+		return "";
+
+	int64_t fm[3] = { int64_t(st.st_size), int64_t(st.st_mtim.tv_sec), int64_t(st.st_mtim.tv_nsec) };
+	float   fp[3] = { lf_ptr->d_min, lf_ptr->d_max, lf_ptr->cost_scale };
+	int     ip[12]= { lf_ptr->W, lf_ptr->H, lf_ptr->U, lf_ptr->V, lf_ptr->type, lf_ptr->nlabels,
+	                  lf_ptr->window, lf_ptr->color_mode, lf_ptr->cost_engine,
+	                  lf_ptr->c2f_step, lf_ptr->c2f_band, lf_ptr->subpixel };
+	uint64_t h = fnv1a(lf_ptr->data_filename.c_str(), lf_ptr->data_filename.size());
+	h = fnv1a(fm, sizeof(fm), h);
+	h = fnv1a(fp, sizeof(fp), h);
+	h = fnv1a(ip, sizeof(ip), h);
+	h = fnv1a(type_name, strlen(type_name), h);
+
+	ostringstream name;
+	name<<lf_ptr->cache_dir<<"/"<<hex<<setw(16)<<setfill('0')<<h<<".h5";
+	return name.str();
+}
+
+/**
+    Store the output of the cost stage: merged volume (H x W x nlabels), the
+    confidence maps, the winner-take-all labels, the sub-label offsets and the
+    central view, which is all a later run needs without decoding the input.
+    The file is written next to its final name and renamed once complete.
+    @path         cache file
+    @merged       merged cost volume
+    @cx cy        confidence maps before spatial filtering
+    @best         winner-take-all labels
+    @sub          sub-label offsets, NULL without SUBPIXEL
+    @lf_ptr       light field structure pointer
+*/
+template<typename LabelT>
+void cost_cache_save(const string& path, const float* merged, const float* cx, const float* cy,
+                     const LabelT* best, const float* sub, LF* lf_ptr){
+
+	int64 t0 = cv::getTickCount();
+	int width  = lf_ptr->W;
+	int height = lf_ptr->H;
+	int num_pixels = width*height;
+
+	mkdir(lf_ptr->cache_dir.c_str(), 0755);
+	string tmp = path + ".tmp";
+	lock_guard<mutex> h5_lock(h5_mutex());
+	hid_t file_id = H5Fcreate(tmp.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	if (file_id<0){
+		cout<<" Cost cache: cannot write "<<tmp<<endl;
+		return;
+	}
+
+	hsize_t dims_v[3]  = { hsize_t(height), hsize_t(width), hsize_t(lf_ptr->nlabels) };
+	hsize_t chunk_v[3] = { hsize_t(min(height, 16)), hsize_t(min(width, 16)), hsize_t(lf_ptr->nlabels) };
+	hsize_t dims_m[3]  = { hsize_t(height), hsize_t(width), 1 };
+	hsize_t chunk_m[3] = { hsize_t(min(height, 64)), hsize_t(width), 1 };
+	hsize_t dims_c[3]  = { hsize_t(height), hsize_t(width), 3 };
+	hsize_t chunk_c[3] = { hsize_t(min(height, 64)), hsize_t(width), 3 };
+
+	vector<uint16_t> labels(best, best+num_pixels);
+	mem2hdf5_chunked(file_id, "cost",         H5T_NATIVE_FLOAT,  dims_v, chunk_v, 4, merged);
+	mem2hdf5_chunked(file_id, "confidence_x", H5T_NATIVE_FLOAT,  dims_m, chunk_m, 4, cx);
+	mem2hdf5_chunked(file_id, "confidence_y", H5T_NATIVE_FLOAT,  dims_m, chunk_m, 4, cy);
+	mem2hdf5_chunked(file_id, "label",        H5T_NATIVE_USHORT, dims_m, chunk_m, 4, &labels[0]);
+	if (sub)
+		mem2hdf5_chunked(file_id, "subpixel", H5T_NATIVE_FLOAT,  dims_m, chunk_m, 4, sub);
+	Mat centre = lf_ptr->imgc.isContinuous() ? lf_ptr->imgc : lf_ptr->imgc.clone();
+	mem2hdf5_chunked(file_id, "centre_view",  H5T_NATIVE_UCHAR,  dims_c, chunk_c, 4, centre.data);
+	H5Fclose(file_id);
+
+	rename(tmp.c_str(), path.c_str());
+	cout<<" Cost cache: stored "<<path<<" in "<<(cv::getTickCount()-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+}
+
+/**
+    Load the output of the cost stage stored by cost_cache_save.
+    @path         cache file
+    @merged       merged cost volume as output
+    @cx cy        confidence maps as output
+    @best         winner-take-all labels as output
+    @sub          sub-label offsets as output, NULL without SUBPIXEL
+    @lf_ptr       light field structure pointer
+    @return       false if there is no complete entry for the key
+*/
+template<typename LabelT>
+bool cost_cache_load(const string& path, float* merged, float* cx, float* cy,
+                     LabelT* best, float* sub, LF* lf_ptr){
+
+	struct stat st;
+	if (stat(path.c_str(), &st)!=0)
+		return false;
+
+	int64 t0 = cv::getTickCount();
+	int width  = lf_ptr->W;
+	int height = lf_ptr->H;
+	int num_pixels = width*height;
+
+	unique_lock<mutex> h5_lock(h5_mutex());
+	hid_t file_id = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file_id<0)
+		return false;
+
+	hsize_t dims_v[3] = { hsize_t(height), hsize_t(width), hsize_t(lf_ptr->nlabels) };
+	hsize_t dims_m[3] = { hsize_t(height), hsize_t(width), 1 };
+	vector<uint16_t> labels(num_pixels);
+
+	bool ok = hdf52mem(file_id, "cost",         H5T_NATIVE_FLOAT,  dims_v, merged) &&
+	          hdf52mem(file_id, "confidence_x", H5T_NATIVE_FLOAT,  dims_m, cx)     &&
+	          hdf52mem(file_id, "confidence_y", H5T_NATIVE_FLOAT,  dims_m, cy)     &&
+	          hdf52mem(file_id, "label",        H5T_NATIVE_USHORT, dims_m, &labels[0]);
+	if (ok && sub)
+		ok = hdf52mem(file_id, "subpixel",  H5T_NATIVE_FLOAT,  dims_m, sub);
+	H5Fclose(file_id);
+	h5_lock.unlock();
+
+	if (!ok)
+		return false;
+	for (int idx=0; idx<num_pixels; idx++)
+		best[idx] = LabelT(labels[idx]);
+
+	cout<<" Cost cache: loaded "<<path<<" in "<<(cv::getTickCount()-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+	return true;
+}
+
+/**
+    Look the scene up in the cache before its input is decoded. On a hit the
+    central view comes from the cache and the input is never read: the cost
+    stage will load the rest of the entry. Lytro images only; HCI scenes take
+    their label range from the ground truth of the input and .lfr containers
+    their size from the header, and verification needs the decoded views.
+    @lf_ptr       light field structure pointer
+    @return       true if the scene runs from the cache without its input
+*/
+bool cost_cache_probe(LF* lf_ptr){
+
+	if ((lf_ptr->type!=1)||(lf_ptr->pipeline!=0)||(lf_ptr->verify==1))
+		return false;
+	string path = cost_cache_path(lf_ptr, cost_type_name(lf_ptr->cost_type));
+	struct stat st;
+	if (path.empty()||(stat(path.c_str(), &st)!=0))
+		return false;
+
+	int width  = lf_ptr->W;
+	int height = lf_ptr->H;
+	Mat centre(height, width, CV_8UC3);
+	hsize_t dims_c[3] = { hsize_t(height), hsize_t(width), 3 };
+
+	lock_guard<mutex> h5_lock(h5_mutex());
+	hid_t file_id = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file_id<0)
+		return false;
+	bool ok = hdf52mem(file_id, "centre_view", H5T_NATIVE_UCHAR, dims_c, centre.data);
+	H5Fclose(file_id);
+	if (!ok)
+		return false;
+
+	lf_ptr->imgc = centre;
+	if (!lf_ptr->centre_view_filename.empty())
+		imwrite(lf_ptr->centre_view_filename.c_str(), lf_ptr->imgc);
+	cout<<" Cost cache: "<<path<<" found, input not decoded"<<endl;
+	return true;
+}
+
+#endif
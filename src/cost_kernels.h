@@ -0,0 +1,149 @@
+//  EPI label sweep kernels (scalar reference and vectorized) plus the runtime kernel selection.
+
+#ifndef _COST_KERNELS
+#define _COST_KERNELS
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "light_field.h"
+#include "cost_simd.h"
+#include "cost_sweep.h"
+
+using namespace std;
+using namespace cv;
+
+/**
+    Signature of a label sweep kernel. For every EPI column in [N/2, cols-N/2)
+    it writes the variance cost and the mean of all labels over a window of N views.
+    @img          EPI view as input
+    @disp         label to disparity table
+    @nlabels      number of labels
+    @cost         per column cost stack as output (cols*nlabels)
+    @mean         per column mean stack as output (cols*nlabels)
+*/
+typedef void (*label_sweep_fn)(const epi_view& img, const float* disp, int nlabels, float* cost, float* mean);
+
+/**
+    Signature of a single pixel kernel evaluating the labels [k0, k1) of EPI
+    column i; cost and mean are indexed by label. The EPI is given by its
+    central row (as many floats per sample as the kernel's channels) and its
+    row stride.
+*/
+typedef void (*label_range_fn)(const float* centre, long rstride, int i, const float* disp,
+                               int k0, int k1, float* cost, float* mean);
+
+/**
+    Scalar reference label sweep.
+*/
+template<int N>
+void label_sweep_scalar(const epi_view& img, const float* disp, int nlabels, float* cost, float* mean){
+
+	const float* centre = epi_row(img, (img.rows-1)/2);
+
+	for (int i=N/2; i<(img.cols-N/2); i++)
+		label_cost_scalar<N>(centre, img.rstride, i, disp, 0, nlabels, cost + i*nlabels, mean + i*nlabels);
+}
+
+/**
+    Pick the label sweep kernel of a window size from the engine and CPU features.
+    @lf_ptr       light field structure pointer; lf_ptr->cost_engine==1 selects the plane sweep,
+                  2 the 8-bit fixed-point plane sweep, lf_ptr->simd==0 forces the scalar reference;
+                  a reduced lf_ptr->color_mode always runs the float plane sweep on its channels
+*/
+template<int N>
+label_sweep_fn select_label_sweep_n(LF* lf_ptr){
+
+	if (lf_ptr->color_mode==1){
+		cout<<" Cost kernel: plane sweep, luminance, "<<N<<" views"<<endl;
+		return label_sweep_plane_c<N,1>;
+	}
+
+	if (lf_ptr->color_mode==2){
+		cout<<" Cost kernel: plane sweep, opponent (2 channels), "<<N<<" views"<<endl;
+		return label_sweep_plane_c<N,2>;
+	}
+
+	if (lf_ptr->cost_engine==2){
+		cout<<" Cost kernel: 8-bit fixed-point plane sweep, "<<N<<" views"<<endl;
+		return label_sweep_u8<N>;
+	}
+
+	if (lf_ptr->cost_engine==1){
+		cout<<" Cost kernel: plane sweep, "<<N<<" views"<<endl;
+		return label_sweep_plane<N>;
+	}
+
+#ifdef LF_COST_SIMD
+	if (lf_ptr->simd){
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")){
+			cout<<" Cost kernel: AVX-512 (16 labels), "<<N<<" views"<<endl;
+			return label_sweep_avx512<N>;
+		}
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+			cout<<" Cost kernel: AVX2 (8 labels), "<<N<<" views"<<endl;
+			return label_sweep_avx2<N>;
+		}
+	}
+#endif
+	cout<<" Cost kernel: scalar, "<<N<<" views"<<endl;
+	return label_sweep_scalar<N>;
+}
+
+/**
+    Pick the single pixel label range kernel of a window size from the colour mode
+    and the CPU features.
+    @lf_ptr       light field structure pointer; lf_ptr->simd==0 forces the scalar reference
+*/
+template<int N>
+label_range_fn select_label_range_n(LF* lf_ptr){
+
+	if (lf_ptr->color_mode==1)
+		return label_cost_chan<N,1>;
+	if (lf_ptr->color_mode==2)
+		return label_cost_chan<N,2>;
+
+#ifdef LF_COST_SIMD
+	if (lf_ptr->simd){
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return label_cost_avx512<N>;
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return label_cost_avx2<N>;
+	}
+#endif
+	return label_cost_scalar<N>;
+}
+
+/**
+    Pick the single pixel label range kernel once per scene (coarse-to-fine search).
+    @lf_ptr       light field structure pointer; lf_ptr->window is 5, 7, 9, 13 or 15
+*/
+label_range_fn select_label_range(LF* lf_ptr){
+
+	switch (lf_ptr->window){
+		case 5:  return select_label_range_n<5> (lf_ptr);
+		case 9:  return select_label_range_n<9> (lf_ptr);
+		case 13: return select_label_range_n<13>(lf_ptr);
+		case 15: return select_label_range_n<15>(lf_ptr);
+		default: return select_label_range_n<7> (lf_ptr);
+	}
+}
+
+/**
+    Pick the label sweep kernel once per scene. The angular window is a compile
+    time constant of the kernels so the view loop stays unrolled.
+    @lf_ptr       light field structure pointer; lf_ptr->window is 5, 7, 9, 13 or 15
+*/
+label_sweep_fn select_label_sweep(LF* lf_ptr){
+
+	switch (lf_ptr->window){
+		case 5:  return select_label_sweep_n<5> (lf_ptr);
+		case 9:  return select_label_sweep_n<9> (lf_ptr);
+		case 13: return select_label_sweep_n<13>(lf_ptr);
+		case 15: return select_label_sweep_n<15>(lf_ptr);
+		default: return select_label_sweep_n<7> (lf_ptr);
+	}
+}
+
+#endif
@@ -0,0 +1,259 @@
+//  Vectorized EPI label sweep (AVX2 / AVX-512) evaluating a block of disparity labels per instruction.
+
+#ifndef _COST_SIMD
+#define _COST_SIMD
+
+#include <opencv2/opencv.hpp>
+#include "light_field.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LF_COST_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+/**
+    Scalar cost of a single pixel for the labels [k0, k1) over an angular window
+    of N views around the central one. This is the reference computation, also
+    used for the label tail that does not fill a vector block.
+    @centre       EPI row of the central view (3 floats per pixel)
+    @rstride      distance between two EPI rows in pixels
+    @i            EPI column (pixel position)
+    @disp         label to disparity table
+    @k0 k1        label range
+    @cost         cost row of pixel i as output (indexed by label)
+    @mean         mean row of pixel i as output (indexed by label)
+*/
+template<int N>
+inline void label_cost_scalar(const float* centre, long rstride, int i, const float* disp,
+                              int k0, int k1, float* cost, float* mean){
+
+	float data_new[3], err[3];
+
+	for (int k=k0; k<k1; k++){
+
+		float tmp1[3] = {0,0,0}, tmp2[3] = {0,0,0};
+
+		for (int t=-N/2; t<=N/2; t++){
+
+			float xnew  = (i + disp[k] * float(t));
+			long idx    = (t*rstride+int(xnew))*3;
+
+			float b = xnew- int(xnew);//bilinear interpolation
+			float a = 1 - b;
+
+			for (int m=0; m<3; m++){
+				data_new[m] = centre[idx+m]*a + centre[idx+3+m]*b ;
+				tmp1[m] = tmp1[m] + data_new[m];
+				tmp2[m] = tmp2[m] + data_new[m]*data_new[m];
+			}
+		}
+
+		for (int m=0; m<3; m++)
+			err[m] = tmp2[m] - tmp1[m]*tmp1[m]/N;
+
+		float err_max = (err[0]  > err[1])? err[0]  : err[1];
+		cost[k]       = (err_max > err[2])? err_max : err[2];
+		mean[k]       = (tmp1[0]+tmp1[1]+tmp1[2])/(3*N);
+	}
+}
+
+#ifdef LF_COST_SIMD
+
+/**
+    AVX2 cost of a single pixel for the labels [k0, k1): 8 labels per instruction,
+    the bilinear samples of the N angular rows are fetched with hardware gathers.
+    Arguments as label_cost_scalar.
+*/
+template<int N> __attribute__((target("avx2,fma")))
+inline void label_cost_avx2(const float* base, long rstride, int i, const float* disp,
+                            int k0, int k1, float* cost, float* mean){
+
+	const __m256  one     = _mm256_set1_ps(1.0f);
+	const __m256  views   = _mm256_set1_ps(float(N));
+	const __m256  views3  = _mm256_set1_ps(float(3*N));
+	const __m256i three   = _mm256_set1_epi32(3);
+	const __m256  fi      = _mm256_set1_ps(float(i));
+
+	int k = k0;
+	for (; k+8<=k1; k+=8){
+
+		__m256 dk = _mm256_loadu_ps(disp+k);
+		__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps();
+		__m256 q0 = _mm256_setzero_ps(), q1 = _mm256_setzero_ps(), q2 = _mm256_setzero_ps();
+
+		for (int t=-N/2; t<=N/2; t++){
+
+			__m256  xnew = _mm256_add_ps(fi, _mm256_mul_ps(dk, _mm256_set1_ps(float(t))));
+			__m256i xi   = _mm256_cvttps_epi32(xnew);
+			__m256  b    = _mm256_sub_ps(xnew, _mm256_cvtepi32_ps(xi));
+			__m256  a    = _mm256_sub_ps(one, b);
+			__m256i idx  = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_set1_epi32(int(t*rstride)), xi), three);
+
+			__m256 v0 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(base  , idx, 4), a),
+			                          _mm256_mul_ps(_mm256_i32gather_ps(base+3, idx, 4), b));
+			__m256 v1 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(base+1, idx, 4), a),
+			                          _mm256_mul_ps(_mm256_i32gather_ps(base+4, idx, 4), b));
+			__m256 v2 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(base+2, idx, 4), a),
+			                          _mm256_mul_ps(_mm256_i32gather_ps(base+5, idx, 4), b));
+			s0 = _mm256_add_ps(s0, v0);  q0 = _mm256_add_ps(q0, _mm256_mul_ps(v0, v0));
+			s1 = _mm256_add_ps(s1, v1);  q1 = _mm256_add_ps(q1, _mm256_mul_ps(v1, v1));
+			s2 = _mm256_add_ps(s2, v2);  q2 = _mm256_add_ps(q2, _mm256_mul_ps(v2, v2));
+		}
+
+		__m256 e0 = _mm256_sub_ps(q0, _mm256_div_ps(_mm256_mul_ps(s0, s0), views));
+		__m256 e1 = _mm256_sub_ps(q1, _mm256_div_ps(_mm256_mul_ps(s1, s1), views));
+		__m256 e2 = _mm256_sub_ps(q2, _mm256_div_ps(_mm256_mul_ps(s2, s2), views));
+
+		_mm256_storeu_ps(cost+k, _mm256_max_ps(_mm256_max_ps(e0, e1), e2));
+		_mm256_storeu_ps(mean+k, _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(s0, s1), s2), views3));
+	}
+
+	label_cost_scalar<N>(base, rstride, i, disp, k, k1, cost, mean);
+}
+
+/**
+    AVX-512 cost of a single pixel for the labels [k0, k1): 16 labels per instruction.
+    Arguments as label_cost_scalar.
+*/
+template<int N> __attribute__((target("avx512f")))
+inline void label_cost_avx512(const float* base, long rstride, int i, const float* disp,
+                              int k0, int k1, float* cost, float* mean){
+
+	const __m512  one     = _mm512_set1_ps(1.0f);
+	const __m512  views   = _mm512_set1_ps(float(N));
+	const __m512  views3  = _mm512_set1_ps(float(3*N));
+	const __m512i three   = _mm512_set1_epi32(3);
+	const __m512  fi      = _mm512_set1_ps(float(i));
+
+	int k = k0;
+	for (; k+16<=k1; k+=16){
+
+		__m512 dk = _mm512_loadu_ps(disp+k);
+		__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps();
+		__m512 q0 = _mm512_setzero_ps(), q1 = _mm512_setzero_ps(), q2 = _mm512_setzero_ps();
+
+		for (int t=-N/2; t<=N/2; t++){
+
+			__m512  xnew = _mm512_add_ps(fi, _mm512_mul_ps(dk, _mm512_set1_ps(float(t))));
+			__m512i xi   = _mm512_cvttps_epi32(xnew);
+			__m512  b    = _mm512_sub_ps(xnew, _mm512_cvtepi32_ps(xi));
+			__m512  a    = _mm512_sub_ps(one, b);
+			__m512i idx  = _mm512_mullo_epi32(_mm512_add_epi32(_mm512_set1_epi32(int(t*rstride)), xi), three);
+
+			__m512 v0 = _mm512_add_ps(_mm512_mul_ps(_mm512_i32gather_ps(idx, base  , 4), a),
+			                          _mm512_mul_ps(_mm512_i32gather_ps(idx, base+3, 4), b));
+			__m512 v1 = _mm512_add_ps(_mm512_mul_ps(_mm512_i32gather_ps(idx, base+1, 4), a),
+			                          _mm512_mul_ps(_mm512_i32gather_ps(idx, base+4, 4), b));
+			__m512 v2 = _mm512_add_ps(_mm512_mul_ps(_mm512_i32gather_ps(idx, base+2, 4), a),
+			                          _mm512_mul_ps(_mm512_i32gather_ps(idx, base+5, 4), b));
+			s0 = _mm512_add_ps(s0, v0);  q0 = _mm512_add_ps(q0, _mm512_mul_ps(v0, v0));
+			s1 = _mm512_add_ps(s1, v1);  q1 = _mm512_add_ps(q1, _mm512_mul_ps(v1, v1));
+			s2 = _mm512_add_ps(s2, v2);  q2 = _mm512_add_ps(q2, _mm512_mul_ps(v2, v2));
+		}
+
+		__m512 e0 = _mm512_sub_ps(q0, _mm512_div_ps(_mm512_mul_ps(s0, s0), views));
+		__m512 e1 = _mm512_sub_ps(q1, _mm512_div_ps(_mm512_mul_ps(s1, s1), views));
+		__m512 e2 = _mm512_sub_ps(q2, _mm512_div_ps(_mm512_mul_ps(s2, s2), views));
+
+		_mm512_storeu_ps(cost+k, _mm512_max_ps(_mm512_max_ps(e0, e1), e2));
+		_mm512_storeu_ps(mean+k, _mm512_div_ps(_mm512_add_ps(_mm512_add_ps(s0, s1), s2), views3));
+	}
+
+	label_cost_scalar<N>(base, rstride, i, disp, k, k1, cost, mean);
+}
+
+/**
+    AVX2 label sweep over all labels of every column.
+    @img          EPI view as input
+    @disp         label to disparity table
+    @nlabels      number of labels
+    @cost         per column cost stack as output (cols*nlabels)
+    @mean         per column mean stack as output (cols*nlabels)
+*/
+template<int N> __attribute__((target("avx2,fma")))
+void label_sweep_avx2(const epi_view& img, const float* disp, int nlabels, float* cost, float* mean){
+
+	const float* centre = epi_row(img, (img.rows-1)/2);
+
+	for (int i=N/2; i<(img.cols-N/2); i++)
+		label_cost_avx2<N>(centre, img.rstride, i, disp, 0, nlabels, cost + i*nlabels, mean + i*nlabels);
+}
+
+/**
+    AVX-512 label sweep over all labels of every column.
+    @img          EPI view as input
+    @disp         label to disparity table
+    @nlabels      number of labels
+    @cost         per column cost stack as output (cols*nlabels)
+    @mean         per column mean stack as output (cols*nlabels)
+*/
+template<int N> __attribute__((target("avx512f")))
+void label_sweep_avx512(const epi_view& img, const float* disp, int nlabels, float* cost, float* mean){
+
+	const float* centre = epi_row(img, (img.rows-1)/2);
+
+	for (int i=N/2; i<(img.cols-N/2); i++)
+		label_cost_avx512<N>(centre, img.rstride, i, disp, 0, nlabels, cost + i*nlabels, mean + i*nlabels);
+}
+
+/**
+    AVX2 reduction of a float cost stack for the optimal slope search: one pass
+    for the minimum and the sum, one compare pass for the first label at the
+    minimum and the number of labels above the average.
+    @data         cost stack
+    @num          number of labels
+    @value_min    minimum as output (at most 100000, as the scalar search)
+    @sum          sum as output
+    @first        first label at the minimum as output, num if none
+    @cnt          number of labels above the average as output
+*/
+__attribute__((target("avx2,popcnt")))
+inline void stack_stats_avx2(const float* data, int num, float& value_min, float& sum, int& first, int& cnt){
+
+	__m256 vmin = _mm256_set1_ps(100000.0f);
+	__m256 vsum = _mm256_setzero_ps();
+	int k = 0;
+	for (; k+8<=num; k+=8){
+		__m256 x = _mm256_loadu_ps(data+k);
+		vmin = _mm256_min_ps(vmin, x);
+		vsum = _mm256_add_ps(vsum, x);
+	}
+	float m[8], s[8];
+	_mm256_storeu_ps(m, vmin);
+	_mm256_storeu_ps(s, vsum);
+	value_min = m[0];
+	sum       = s[0];
+	for (int n=1; n<8; n++){
+		value_min = (m[n]<value_min) ? m[n] : value_min;
+		sum      += s[n];
+	}
+	for (; k<num; k++){
+		value_min = (data[k]<value_min) ? data[k] : value_min;
+		sum      += data[k];
+	}
+
+	float avg = sum/num;
+	__m256 vavg = _mm256_set1_ps(avg);
+	__m256 vm   = _mm256_set1_ps(value_min);
+	first = num;
+	cnt   = 0;
+	for (k=0; k+8<=num; k+=8){
+		__m256 x = _mm256_loadu_ps(data+k);
+		cnt += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_cmp_ps(x, vavg, _CMP_GT_OQ)));
+		int eq = _mm256_movemask_ps(_mm256_cmp_ps(x, vm, _CMP_EQ_OQ));
+		if (eq&&(first==num))
+			first = k + __builtin_ctz(eq);
+	}
+	for (; k<num; k++){
+		cnt += (data[k]>avg);
+		if ((data[k]==value_min)&&(first==num))
+			first = k;
+	}
+}
+
+#endif
+
+#endif
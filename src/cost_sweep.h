@@ -0,0 +1,303 @@
+//  Label-outer plane-sweep formulation of the EPI cost with precomputed shift tables
+//  (float and 8-bit fixed-point).
+
+#ifndef _COST_SWEEP
+#define _COST_SWEEP
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+#include "light_field.h"
+#include "cost_simd.h"
+
+using namespace std;
+using namespace cv;
+
+/**
+    Scalar cost of a single pixel for the labels [k0, k1) on C interleaved float
+    channels; the same computation as label_cost_scalar, which it matches for
+    C = 3. The cost is the largest channel variance, the mean that of all channels.
+    @centre       EPI row of the central view (C floats per pixel)
+    @rstride      distance between two EPI rows in pixels
+    @i            EPI column (pixel position)
+    @disp         label to disparity table
+    @k0 k1        label range
+    @cost         cost row of pixel i as output (indexed by label)
+    @mean         mean row of pixel i as output (indexed by label)
+*/
+template<int N, int C>
+inline void label_cost_chan(const float* centre, long rstride, int i, const float* disp,
+                            int k0, int k1, float* cost, float* mean){
+
+	for (int k=k0; k<k1; k++){
+
+		float tmp1[C], tmp2[C];
+		for (int m=0; m<C; m++)
+			tmp1[m] = tmp2[m] = 0;
+
+		for (int t=-N/2; t<=N/2; t++){
+
+			float xnew  = (i + disp[k] * float(t));
+			long idx    = (t*rstride+int(xnew))*C;
+
+			float b = xnew- int(xnew);//bilinear interpolation
+			float a = 1 - b;
+
+			for (int m=0; m<C; m++){
+				float v = centre[idx+m]*a + centre[idx+C+m]*b;
+				tmp1[m] = tmp1[m] + v;
+				tmp2[m] = tmp2[m] + v*v;
+			}
+		}
+
+		float err_max = tmp2[0] - tmp1[0]*tmp1[0]/N;
+		float sum     = tmp1[0];
+		for (int m=1; m<C; m++){
+			float err = tmp2[m] - tmp1[m]*tmp1[m]/N;
+			err_max   = (err_max > err)? err_max : err;
+			sum       = sum + tmp1[m];
+		}
+		cost[k] = err_max;
+		mean[k] = sum/(C*N);
+	}
+}
+
+/**
+    Plane-sweep label sweep. The shift of a (label, view) pair is the same for
+    every EPI column, so it is split once into an integer offset and a fixed
+    bilinear weight. Each label then resamples the angular rows with unit-stride
+    loads and accumulates sum and sum-of-squares across all columns at once,
+    which the compiler vectorizes over the C interleaved colour channels. The
+    angular window has N views.
+    @img          EPI view as input
+    @disp         label to disparity table
+    @nlabels      number of labels
+    @cost         per column cost stack as output (cols*nlabels)
+    @mean         per column mean stack as output (cols*nlabels)
+*/
+template<int N, int C>
+void label_sweep_plane_c(const epi_view& img, const float* disp, int nlabels, float* cost, float* mean){
+
+	const float* base = epi_row(img, (img.rows-1)/2);
+	int cols = img.cols;
+
+	//the reference truncates towards zero; columns whose samples fall left of
+	//the EPI keep that behaviour through the scalar path
+	const int R = N/2;
+	int i0 = R;
+	for (int k=0; k<nlabels; k++)
+		for (int t=-R; t<=R; t++)
+			i0 = max(i0, int(ceil(-disp[k] * float(t))));
+	i0 = min(i0, cols-R);
+	for (int i=R; i<i0; i++)
+		label_cost_chan<N,C>(base, img.rstride, i, disp, 0, nlabels, cost + i*nlabels, mean + i*nlabels);
+
+	int n = C*(cols-R-i0);  //interleaved samples of the columns [i0, cols-R)
+	if (n<=0) return;
+
+	//shift table: integer offset and bilinear weight per (label, view)
+	vector<long>  offset(nlabels*N);
+	vector<float> weight(nlabels*N);
+	for (int k=0; k<nlabels; k++)
+		for (int t=-R; t<=R; t++){
+			float s  = disp[k] * float(t);
+			int   o  = int(floor(s));
+			offset[k*N+t+R] = (t*img.rstride + i0 + o)*C;
+			weight[k*N+t+R] = s - float(o);
+		}
+
+	vector<float> sum(n), sq(n);
+	float* sum_ptr = &sum[0];
+	float* sq_ptr  = &sq[0];
+
+	for (int k=0; k<nlabels; k++){
+
+		memset(sum_ptr, 0, n*sizeof(float));
+		memset(sq_ptr,  0, n*sizeof(float));
+
+		for (int t=0; t<N; t++){
+
+			const float* row = base + offset[k*N+t];
+			float b = weight[k*N+t];
+			float a = 1 - b;
+
+			for (int x=0; x<n; x++){
+				float v    = row[x]*a + row[x+C]*b;
+				sum_ptr[x] = sum_ptr[x] + v;
+				sq_ptr[x]  = sq_ptr[x]  + v*v;
+			}
+		}
+
+		float* cost_ptr = cost + i0*nlabels + k;
+		float* mean_ptr = mean + i0*nlabels + k;
+
+		for (int x=0; x<n; x+=C){
+
+			float err_max = sq_ptr[x] - sum_ptr[x]*sum_ptr[x]/N;
+			float s       = sum_ptr[x];
+			for (int m=1; m<C; m++){
+				float err = sq_ptr[x+m] - sum_ptr[x+m]*sum_ptr[x+m]/N;
+				err_max   = (err_max > err)? err_max : err;
+				s         = s + sum_ptr[x+m];
+			}
+			*cost_ptr     = err_max;
+			*mean_ptr     = s/(C*N);
+			cost_ptr     += nlabels;
+			mean_ptr     += nlabels;
+		}
+	}
+}
+
+/**
+    RGB plane sweep.
+*/
+template<int N>
+void label_sweep_plane(const epi_view& img, const float* disp, int nlabels, float* cost, float* mean){
+
+	label_sweep_plane_c<N,3>(img, disp, nlabels, cost, mean);
+}
+
+/**
+    Fixed-point bilinear weights: a sample is (p0*(LF_Q_ONE-w) + p1*w) with w in
+    [0, LF_Q_ONE], i.e. the 8-bit pixels scaled by LF_Q_ONE.
+*/
+#define LF_Q_BITS 5
+#define LF_Q_ONE  (1<<LF_Q_BITS)
+
+/**
+    Cost and mean of one label from the fixed-point sums of the N views of one
+    channel triple. The variance is computed exactly in 64-bit integers and
+    scaled back to 8-bit units.
+*/
+template<int N>
+inline void label_cost_u8_finish(const int32_t* sum, const int32_t* sq, float* cost, float* mean){
+
+	const float unit = 1.0f/float(LF_Q_ONE*LF_Q_ONE);
+	float err[3];
+	for (int m=0; m<3; m++)
+		err[m] = float(int64_t(N)*sq[m] - int64_t(sum[m])*sum[m]) * (unit/N);
+
+	float err_max = (err[0]  > err[1])? err[0]  : err[1];
+	*cost         = (err_max > err[2])? err_max : err[2];
+	*mean         = float(sum[0]+sum[1]+sum[2]) * (1.0f/float(3*N*LF_Q_ONE));
+}
+
+/**
+    8-bit fixed-point cost of a single pixel for the labels [k0, k1). Same
+    sampling as label_cost_scalar (truncation towards zero) with the weights
+    rounded to LF_Q_BITS bits.
+    @centre       EPI row of the central view (3 channels per pixel, 8-bit)
+    @rstride      distance between two EPI rows in pixels
+    @i            EPI column (pixel position)
+    @disp         label to disparity table
+    @k0 k1        label range
+    @cost         cost row of pixel i as output (indexed by label)
+    @mean         mean row of pixel i as output (indexed by label)
+*/
+template<int N>
+inline void label_cost_u8(const Vec3b* centre, long rstride, int i, const float* disp,
+                          int k0, int k1, float* cost, float* mean){
+
+	for (int k=k0; k<k1; k++){
+
+		int32_t sum[3] = {0,0,0}, sq[3] = {0,0,0};
+
+		for (int t=-N/2; t<=N/2; t++){
+
+			float xnew  = (i + disp[k] * float(t));
+			long idx    = t*rstride+int(xnew);
+			int  w      = int(lrintf((xnew - int(xnew))*LF_Q_ONE));
+
+			for (int m=0; m<3; m++){
+				int32_t v = int32_t(centre[idx][m])*(LF_Q_ONE-w) + int32_t(centre[idx+1][m])*w;
+				sum[m] += v;
+				sq[m]  += v*v;
+			}
+		}
+		label_cost_u8_finish<N>(sum, sq, cost+k, mean+k);
+	}
+}
+
+/**
+    8-bit fixed-point plane sweep. The EPI stays in 8-bit, the shift table
+    holds an integer offset and a LF_Q_BITS weight per (label, view), and the
+    sum and sum-of-squares are accumulated in int32 lanes (exact for up to 15
+    views) which the compiler vectorizes over the interleaved channels.
+    @img          EPI view as input (img.data8)
+    @disp         label to disparity table
+    @nlabels      number of labels
+    @cost         per column cost stack as output (cols*nlabels)
+    @mean         per column mean stack as output (cols*nlabels)
+*/
+template<int N>
+void label_sweep_u8(const epi_view& img, const float* disp, int nlabels, float* cost, float* mean){
+
+	const Vec3b*   centre = img.data8 + (img.rows-1)/2*img.rstride;
+	const uint8_t* base   = (const uint8_t*)(centre);
+	int cols = img.cols;
+
+	//head columns keep the truncating reference sampling, see label_sweep_plane
+	const int R = N/2;
+	int i0 = R;
+	for (int k=0; k<nlabels; k++)
+		for (int t=-R; t<=R; t++)
+			i0 = max(i0, int(ceil(-disp[k] * float(t))));
+	i0 = min(i0, cols-R);
+	for (int i=R; i<i0; i++)
+		label_cost_u8<N>(centre, img.rstride, i, disp, 0, nlabels, cost + i*nlabels, mean + i*nlabels);
+
+	int n = 3*(cols-R-i0);
+	if (n<=0) return;
+
+	vector<long>    offset(nlabels*N);
+	vector<int32_t> weight(nlabels*N);
+	for (int k=0; k<nlabels; k++)
+		for (int t=-R; t<=R; t++){
+			float s  = disp[k] * float(t);
+			int   o  = int(floor(s));
+			int   w  = int(lrintf((s - float(o))*LF_Q_ONE));
+			if (w==LF_Q_ONE){
+				o++;
+				w = 0;
+			}
+			offset[k*N+t+R] = (t*img.rstride + i0 + o)*3;
+			weight[k*N+t+R] = w;
+		}
+
+	vector<int32_t> sum(n), sq(n);
+	int32_t* sum_ptr = &sum[0];
+	int32_t* sq_ptr  = &sq[0];
+
+	for (int k=0; k<nlabels; k++){
+
+		memset(sum_ptr, 0, n*sizeof(int32_t));
+		memset(sq_ptr,  0, n*sizeof(int32_t));
+
+		for (int t=0; t<N; t++){
+
+			const uint8_t* row = base + offset[k*N+t];
+			int32_t b = weight[k*N+t];
+			int32_t a = LF_Q_ONE - b;
+
+			for (int x=0; x<n; x++){
+				int32_t v  = int32_t(row[x])*a + int32_t(row[x+3])*b;
+				sum_ptr[x] = sum_ptr[x] + v;
+				sq_ptr[x]  = sq_ptr[x]  + v*v;
+			}
+		}
+
+		float* cost_ptr = cost + i0*nlabels + k;
+		float* mean_ptr = mean + i0*nlabels + k;
+
+		for (int x=0; x<n; x+=3){
+			label_cost_u8_finish<N>(sum_ptr+x, sq_ptr+x, cost_ptr, mean_ptr);
+			cost_ptr += nlabels;
+			mean_ptr += nlabels;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,160 @@
+//  Element types of the cost volumes (float, saturating uint16, IEEE half) and their encoding.
+
+#ifndef _COST_TYPES
+#define _COST_TYPES
+
+#include <stdint.h>
+#include <cstring>
+#include <cfloat>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+/**
+    IEEE 754 half precision (binary16) storage.
+*/
+struct cost_half { uint16_t bits; };
+
+/**
+    Round a float to the nearest half, saturating to the largest finite half.
+    @f            value to convert
+*/
+inline uint16_t float2half(float f){
+
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint16_t sign = (x>>16) & 0x8000;
+	x &= 0x7fffffff;
+
+	if (x >= 0x477ff000)  //would round to inf (or NaN)
+		return sign | 0x7bff;
+
+	if (x <  0x38800000){ //subnormal half
+		if (x < 0x33000000)
+			return sign;
+		uint32_t m     = (x & 0x7fffff) | 0x800000;
+		int      shift = 126 - int(x>>23);
+		uint32_t r     = m >> shift;
+		uint32_t rem   = m & ((1u<<shift)-1);
+		uint32_t half  = 1u<<(shift-1);
+		if ((rem > half) || ((rem == half) && (r & 1)))
+			r++;
+		return sign | r;
+	}
+
+	uint32_t r   = (x - 0x38000000) >> 13;
+	uint32_t rem = x & 0x1fff;
+	if ((rem > 0x1000) || ((rem == 0x1000) && (r & 1)))
+		r++;
+	return sign | r;
+}
+
+/**
+    Expand a half to float.
+    @h            half bits
+*/
+inline float half2float(uint16_t h){
+
+#if defined(__F16C__)
+	return _cvtsh_ss(h);
+#else
+	uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t e    = (h>>10) & 0x1f;
+	uint32_t m    = h & 0x3ff;
+	uint32_t x;
+	float f;
+
+	if (e == 0){
+		f = float(m) * (1.0f/16777216.0f); //m * 2^-24
+		memcpy(&x, &f, 4);
+		x |= sign;
+	}
+	else if (e == 31)
+		x = sign | 0x7f800000 | (m<<13);
+	else
+		x = sign | ((e+112)<<23) | (m<<13);
+
+	memcpy(&f, &x, 4);
+	return f;
+#endif
+}
+
+/**
+    Encoding of a cost volume element. A value v is stored as v*scale and
+    read back as stored/scale; the float volume ignores the scale.
+*/
+template<typename T> struct cost_codec;
+
+template<> struct cost_codec<float>{
+	static const bool  quantized = false;
+	static const char* name()      { return "float"; }
+	static float       max_value() { return FLT_MAX; }
+	static inline float encode(float v, float scale){ return v; }
+	static inline float decode(float v, float scale){ return v; }
+};
+
+template<> struct cost_codec<uint16_t>{
+	static const bool  quantized = true;
+	static const char* name()      { return "uint16"; }
+	static float       max_value() { return 65535.0f; }
+	static inline uint16_t encode(float v, float scale){
+		float x = v*scale + 0.5f;
+		return (x <= 0) ? 0 : (x >= 65535.0f) ? 65535 : uint16_t(x);
+	}
+	static inline float decode(uint16_t v, float scale){ return float(v)/scale; }
+};
+
+template<> struct cost_codec<cost_half>{
+	static const bool  quantized = true;
+	static const char* name()      { return "half"; }
+	static float       max_value() { return 65504.0f; }
+	static inline cost_half encode(float v, float scale){
+		cost_half h;
+		h.bits = float2half(v*scale);
+		return h;
+	}
+	static inline float decode(cost_half v, float scale){ return half2float(v.bits)/scale; }
+};
+
+/**
+    Element type name of a COST_TYPE, cost_codec<T>::name() of the type it selects.
+    @cost_type    0: float, 1: uint16, 2: half
+*/
+inline const char* cost_type_name(int cost_type){
+
+	return (cost_type==1) ? cost_codec<uint16_t>::name() :
+	       (cost_type==2) ? cost_codec<cost_half>::name() : cost_codec<float>::name();
+}
+
+/**
+    Read access to a dense cost volume (nlabels values per pixel) in cost units.
+*/
+template<typename T>
+struct dense_volume{
+
+	T*    data;
+	int   nlabels;
+	float scale;
+
+	dense_volume(T* data, int nlabels, float scale) : data(data), nlabels(nlabels), scale(scale) {}
+
+	float at(int idx, int k) const { return cost_codec<T>::decode(data[idx*nlabels+k], scale); }
+
+	/** Every label of a dense volume has its full resolution cost. */
+	bool exact(int idx, int k) const { return true; }
+};
+
+/**
+    Quantization scale that maps the largest possible cost of a scene onto the
+    range of the element type, so the encoding never saturates. The cost is the
+    box filtered (3 columns) per channel variance of nviews 8-bit samples.
+    @nviews       number of views in the angular window
+*/
+template<typename T> float cost_scale_auto(int nviews){
+
+	float bound = 3.0f * float(nviews) * 127.5f * 127.5f;
+	return cost_codec<T>::max_value() / bound;
+}
+
+#endif
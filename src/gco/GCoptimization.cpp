@@ -102,6 +102,8 @@ GCoptimization::GCoptimization(SiteID nSites, LabelID nLabels)
 , m_setupDataCostsExpansion(0)
 , m_setupSmoothCostsSwap(0)
 , m_setupSmoothCostsExpansion(0)
+, m_setupDataCostsDynamic(0)
+, m_setupSmoothCostsDynamic(0)
 , m_applyNewLabeling(0)
 , m_updateLabelingDataCosts(0)
 , m_giveSmoothEnergyInternal(0)
@@ -119,6 +121,11 @@ GCoptimization::GCoptimization(SiteID nSites, LabelID nLabels)
 , m_activeLabelCounts(new SiteID[m_num_labels])
 , m_stepsThisCycle(0)
 , m_stepsThisCycleTotal(0)
+, m_poolEnergy(0)
+, m_poolActiveSites(0)
+, m_pool(false)
+, m_dynamic(0)
+, m_dynamicCount(0)
 {
 	if ( nLabels <= 1 ) handleError("Number of labels must be >= 2");
 	if ( nSites <= 0 )  handleError("Number of sites must be >= 1");
@@ -142,6 +149,7 @@ GCoptimization::GCoptimization(SiteID nSites, LabelID nLabels)
 
 GCoptimization::~GCoptimization()
 {
+	setPoolMode(false);
 	delete [] m_labelTable;
 	delete [] m_lookupSiteVar;
 	delete [] m_labeling;
@@ -191,6 +199,21 @@ void GCoptimization::setupDataCostsExpansion<GCoptimization::DataCostFnSparse>(S
 
 //-------------------------------------------------------------------
 
+template <>
+void GCoptimization::setupDataCostsExpansion<GCoptimization::DataCostFnFromRows>(SiteID size,LabelID alpha_label,EnergyT *e,SiteID *activeSites)
+{
+	DataCostFnFromRows* dc = (DataCostFnFromRows*)m_datacostFn;
+	for ( SiteID i = 0; i < size; ++i )
+	{
+		SiteID site = activeSites[i];
+		if ( dc->isFree(site) ) // both terms are 0
+			continue;
+		addterm1_checked(e,i,dc->compute(site,alpha_label),m_labelingDataCosts[site]);
+	}
+}
+
+//-------------------------------------------------------------------
+
 template <>
 void GCoptimization::applyNewLabeling<GCoptimization::DataCostFnSparse>(EnergyT *e,SiteID *activeSites,SiteID size,LabelID alpha_label)
 {
@@ -229,6 +252,7 @@ void GCoptimization::specializeDataCostFunctor(const UserFunctor f) {
 	m_datacostFnDelete          = &GCoptimization::deleteFunctor<UserFunctor>;
 	m_queryActiveSitesExpansion = &GCoptimization::queryActiveSitesExpansion<UserFunctor>;
 	m_setupDataCostsExpansion   = &GCoptimization::setupDataCostsExpansion<UserFunctor>;
+	m_setupDataCostsDynamic     = &GCoptimization::setupDataCostsDynamic<UserFunctor>;
 	m_setupDataCostsSwap        = &GCoptimization::setupDataCostsSwap<UserFunctor>;
 	m_applyNewLabeling          = &GCoptimization::applyNewLabeling<UserFunctor>;
 	m_updateLabelingDataCosts   = &GCoptimization::updateLabelingDataCosts<UserFunctor>;
@@ -248,6 +272,7 @@ void GCoptimization::specializeSmoothCostFunctor(const UserFunctor f) {
 	m_smoothcostFnDelete        = &GCoptimization::deleteFunctor<UserFunctor>;
 	m_giveSmoothEnergyInternal  = &GCoptimization::giveSmoothEnergyInternal<UserFunctor>;
 	m_setupSmoothCostsExpansion = &GCoptimization::setupSmoothCostsExpansion<UserFunctor>;
+	m_setupSmoothCostsDynamic   = &GCoptimization::setupSmoothCostsDynamic<UserFunctor>;
 	m_setupSmoothCostsSwap      = &GCoptimization::setupSmoothCostsSwap<UserFunctor>;
 }
 
@@ -361,6 +386,56 @@ void GCoptimization::setupSmoothCostsExpansion(SiteID size,LabelID alpha_label,E
 	}
 }
 
+//-----------------------------------------------------------------------------------
+// Dynamic mode: unary of every site for alpha_label, E(alpha) goes to the constant
+// and E(keep)-E(alpha) to the unary term paid when the site keeps its label
+
+template <typename DataCostT>
+void GCoptimization::setupDataCostsDynamic(DynamicGraph& g,LabelID alpha_label,EnergyType& constant)
+{
+	DataCostT* dc = (DataCostT*)m_datacostFn;
+	EnergyTermType *unary = g.unaryNext;
+	for ( SiteID i = 0; i < m_num_sites; i++ )
+	{
+		EnergyTermType e0 = dc->compute(i,alpha_label), e1 = m_labelingDataCosts[i];
+		if ( e0 > GCO_MAX_ENERGYTERM || e1 > GCO_MAX_ENERGYTERM )
+			handleError("Data cost term was larger than GCO_MAX_ENERGYTERM; danger of integer overflow.");
+		constant += e0;
+		m_beforeExpansionEnergy += e1;
+		unary[i] += e1-e0;
+	}
+}
+
+//-----------------------------------------------------------------------------------
+// Dynamic mode: the pairwise term of edge k is reduced to A + (C-A)x + (D-C)y + (B+C-A-D)(1-x)y
+// with x,y = 1 when the site keeps its label; the last part is the capacity of the edge
+
+template <typename SmoothCostT>
+void GCoptimization::setupSmoothCostsDynamic(DynamicGraph& g,LabelID alpha_label,EnergyType& constant)
+{
+	SmoothCostT* sc = (SmoothCostT*)m_smoothcostFn;
+	for ( SiteID k = 0; k < g.numEdges; k++ )
+	{
+		SiteID x = g.edgeX[k], y = g.edgeY[k];
+		EnergyTermType w = g.edgeW[k];
+		EnergyTermType e00 = sc->compute(x,y,alpha_label,alpha_label);
+		EnergyTermType e01 = sc->compute(x,y,alpha_label,m_labeling[y]);
+		EnergyTermType e10 = sc->compute(x,y,m_labeling[x],alpha_label);
+		EnergyTermType e11 = sc->compute(x,y,m_labeling[x],m_labeling[y]);
+		if ( e00 > GCO_MAX_ENERGYTERM || e11 > GCO_MAX_ENERGYTERM || e01 > GCO_MAX_ENERGYTERM || e10 > GCO_MAX_ENERGYTERM )
+			handleError("Smooth cost term was larger than GCO_MAX_ENERGYTERM; danger of integer overflow.");
+		if ( w > GCO_MAX_ENERGYTERM )
+			handleError("Smoothness weight was larger than GCO_MAX_ENERGYTERM; danger of integer overflow.");
+		if ( e00+e11 > e01+e10 )
+			handleError("Non-submodular expansion term detected; smooth costs must be a metric for expansion");
+		constant += e00*w;
+		m_beforeExpansionEnergy += e11*w;
+		g.unaryNext[x] += (e10-e00)*w;
+		g.unaryNext[y] += (e11-e10)*w;
+		updateDynamicEdge(g,k,(e01+e10-e00-e11)*w);
+	}
+}
+
 //-----------------------------------------------------------------------------------
 
 template <typename DataCostT>
@@ -735,6 +810,172 @@ void GCoptimization::setDataCost(EnergyTermType *dataArray) {
 
 //-------------------------------------------------------------------
 
+void GCoptimization::setPoolMode(bool enable)
+{
+	if ( enable && !m_poolActiveSites )
+		m_poolActiveSites = new SiteID[m_num_sites];
+	if ( !enable )
+	{
+		delete m_poolEnergy;
+		delete [] m_poolActiveSites;
+		m_poolEnergy = 0;
+		m_poolActiveSites = 0;
+	}
+	m_pool = enable;
+}
+
+//-------------------------------------------------------------------
+
+GCoptimization::DynamicGraph::DynamicGraph()
+: e(0), numSites(0), numEdges(0), sites(0), edgeX(0), edgeY(0), edgeW(0), edgeCap(0)
+, unary(0), unaryNext(0), fresh(true), marked(0), changed(0), moves(0), reused(0), builds(0)
+{
+}
+
+GCoptimization::DynamicGraph::~DynamicGraph()
+{
+	clear();
+}
+
+void GCoptimization::DynamicGraph::clear()
+{
+	delete e;
+	delete [] sites;
+	delete [] edgeX;
+	delete [] edgeY;
+	delete [] edgeW;
+	delete [] edgeCap;
+	delete [] unary;
+	delete [] unaryNext;
+	delete [] marked;
+	e = 0;
+	sites = edgeX = edgeY = 0;
+	edgeW = edgeCap = unary = unaryNext = 0;
+	marked = 0;
+	numSites = numEdges = 0;
+	fresh = true;
+}
+
+//-------------------------------------------------------------------
+
+void GCoptimization::setDynamicGraph(DynamicGraph* g, LabelID count)
+{
+	if ( g && count < 1 )
+		handleError("Number of dynamic graphs must be >= 1");
+	m_dynamic = g;
+	m_dynamicCount = count;
+}
+
+//-------------------------------------------------------------------
+// Dynamic mode: reads the edges and their weights, and builds the graph again
+// (all sites, zero capacities) when the neighborhood system differs from the one it holds
+
+void GCoptimization::setupDynamicGraph(DynamicGraph& g)
+{
+	SiteID site,n,nNum,*nPointer,k = 0;
+	EnergyTermType *weights;
+	bool same = g.e && g.numSites == m_num_sites;
+
+	for ( site = 0; site < m_num_sites; site++ )
+	{
+		giveNeighborInfo(site,&nNum,&nPointer,&weights);
+		for ( n = 0; n < nNum; n++ )
+			if ( nPointer[n] < site )
+			{
+				if ( same && (k >= g.numEdges || g.edgeX[k] != site || g.edgeY[k] != nPointer[n]) )
+					same = false;
+				if ( same )
+					g.edgeW[k] = weights[n];
+				k++;
+			}
+	}
+	if ( same && k == g.numEdges )
+		return;
+
+	g.clear();
+	g.numSites  = m_num_sites;
+	g.numEdges  = k;
+	g.sites     = new SiteID[m_num_sites];
+	g.unary     = new EnergyTermType[m_num_sites];
+	g.unaryNext = new EnergyTermType[m_num_sites];
+	g.marked    = new unsigned char[m_num_sites];
+	g.edgeX     = new SiteID[k];
+	g.edgeY     = new SiteID[k];
+	g.edgeW     = new EnergyTermType[k];
+	g.edgeCap   = new EnergyTermType[k];
+	g.e = new EnergyT(m_num_sites,k,handleError);
+	g.e->add_variable(m_num_sites);
+	for ( SiteID i = 0; i < m_num_sites; i++ )
+		g.sites[i] = i;
+	memset(g.unary,0,m_num_sites*sizeof(EnergyTermType));
+
+	// the arcs of edge k are allocated in order, so they are found again by index
+	for ( k = 0, site = 0; site < m_num_sites; site++ )
+	{
+		giveNeighborInfo(site,&nNum,&nPointer,&weights);
+		for ( n = 0; n < nNum; n++ )
+			if ( nPointer[n] < site )
+			{
+				g.edgeX[k]   = site;
+				g.edgeY[k]   = nPointer[n];
+				g.edgeW[k]   = weights[n];
+				g.edgeCap[k] = 0;
+				g.e->add_edge(site,nPointer[n],0,0);
+				k++;
+			}
+	}
+	g.builds++;
+}
+
+//-------------------------------------------------------------------
+// Dynamic mode: sets the capacity of edge k on the graph that holds the flow of the previous
+// move. When the new capacity is below the flow through x->y, the excess e is cancelled with
+// the identity  -e[x=0,y=1] = -e[x=1,y=0] - e[y=1] + e[x=1], i.e. moved to the sister arc
+// and the terminal links (the residual capacities of the two arcs always sum up to the capacity)
+
+inline void GCoptimization::updateDynamicEdge(DynamicGraph& g,SiteID k,EnergyTermType cap)
+{
+	EnergyTermType delta = cap - g.edgeCap[k];
+	if ( delta == 0 )
+		return;
+	g.edgeCap[k] = cap;
+
+	SiteID x = g.edgeX[k], y = g.edgeY[k];
+	EnergyT::arc_id a = g.e->get_first_arc() + 2*k; // x->y, a+1 is y->x
+	EnergyTermType rcap = g.e->get_rcap(a) + delta;
+	if ( rcap < 0 )
+	{
+		g.e->set_rcap(a,0);
+		g.e->set_rcap(a+1,g.e->get_rcap(a+1)+rcap);
+		g.e->add_tweights(x,-rcap,0);
+		g.e->add_tweights(y,rcap,0);
+	}
+	else
+		g.e->set_rcap(a,rcap);
+	markDynamicNode(g,x);
+	markDynamicNode(g,y);
+}
+
+//-------------------------------------------------------------------
+
+inline void GCoptimization::markDynamicNode(DynamicGraph& g,SiteID i)
+{
+	if ( g.fresh || g.marked[i] )
+		return;
+	g.e->mark_node(i);
+	g.marked[i] = 1;
+	g.changed++;
+}
+
+//-------------------------------------------------------------------
+
+void GCoptimization::setDataCostRows(EnergyTermType *rows, SiteID *rowOfSite) {
+	specializeDataCostFunctor(DataCostFnFromRows(rows, rowOfSite, m_num_labels));
+	m_labelingInfoDirty = true;
+}
+
+//-------------------------------------------------------------------
+
 void GCoptimization::setDataCost(SiteID s, LabelID l, EnergyTermType e) {
 	if ( !m_datacostIndividual )
 	{
@@ -763,6 +1004,7 @@ void GCoptimization::setDataCostFunctor(DataCostFunctor* f) {
 	m_datacostFnDelete          = 0;
 	m_queryActiveSitesExpansion = &GCoptimization::queryActiveSitesExpansion<DataCostFunctor>;
 	m_setupDataCostsExpansion   = &GCoptimization::setupDataCostsExpansion<DataCostFunctor>;
+	m_setupDataCostsDynamic     = &GCoptimization::setupDataCostsDynamic<DataCostFunctor>;
 	m_setupDataCostsSwap        = &GCoptimization::setupDataCostsSwap<DataCostFunctor>;
 	m_applyNewLabeling          = &GCoptimization::applyNewLabeling<DataCostFunctor>;
 	m_updateLabelingDataCosts   = &GCoptimization::updateLabelingDataCosts<DataCostFunctor>;
@@ -828,6 +1070,7 @@ void GCoptimization::setSmoothCostFunctor(SmoothCostFunctor* f) {
 	m_smoothcostFnDelete        = 0;
 	m_giveSmoothEnergyInternal  = &GCoptimization::giveSmoothEnergyInternal<SmoothCostFunctor>;
 	m_setupSmoothCostsExpansion = &GCoptimization::setupSmoothCostsExpansion<SmoothCostFunctor>;
+	m_setupSmoothCostsDynamic   = &GCoptimization::setupSmoothCostsDynamic<SmoothCostFunctor>;
 	m_setupSmoothCostsSwap      = &GCoptimization::setupSmoothCostsSwap<SmoothCostFunctor>;
 }
 
@@ -1199,6 +1442,10 @@ inline bool GCoptimization::alpha_expansion(LabelID alpha_label)
 	if (alpha_label < 0)
 		return false; // label was disabled due to setLabelOrder on subset of labels
 
+	if ( m_dynamic && !m_labelcostCount &&
+	     m_queryActiveSitesExpansion != (SiteID (GCoptimization::*)(LabelID,SiteID*))&GCoptimization::queryActiveSitesExpansion<DataCostFnSparse> )
+		return alpha_expansion_dynamic(alpha_label);
+
 	finalizeNeighbors();
 	gcoclock_t ticks0 = gcoclock();
 
@@ -1208,8 +1455,9 @@ inline bool GCoptimization::alpha_expansion(LabelID alpha_label)
 
 	// Determine list of active sites for this expansion move
 	SiteID size = 0;
-	SiteID *activeSites = new SiteID[m_num_sites];
+	SiteID *activeSites = m_pool ? m_poolActiveSites : new SiteID[m_num_sites];
 	EnergyType afterExpansionEnergy = 0;
+	EnergyT *e = 0;
 
 	try 
 	{  
@@ -1218,7 +1466,7 @@ inline bool GCoptimization::alpha_expansion(LabelID alpha_label)
 			size = (this->*m_queryActiveSitesExpansion)(alpha_label,activeSites);
 		if ( size == 0 )  // Nothing to do
 		{
-			delete [] activeSites;
+			if ( !m_pool ) delete [] activeSites;
 			printStatus2(alpha_label,-1,size,ticks0);
 			return false;
 		}
@@ -1231,27 +1479,42 @@ inline bool GCoptimization::alpha_expansion(LabelID alpha_label)
 
 		// Create binary variables for each remaining site, add the data costs,
 		// and compute the smooth costs between variables.
-		EnergyT e(size+m_labelcostCount, // poor guess at number of pairwise terms needed :(
-				 m_numNeighborsTotal+(m_labelcostCount?size+m_labelcostCount : 0),
-				 handleError);
+		// In pool mode the graph is sized once for all sites and only reset here
+		if ( m_pool )
+		{
+			if ( !m_poolEnergy )
+			{
+				m_poolEnergy = new EnergyT(m_num_sites+m_labelcostCount,
+				                           m_numNeighborsTotal+(m_labelcostCount?m_num_sites+m_labelcostCount : 0),
+				                           handleError);
+				m_poolEnergy->keep_blocks(true);
+			}
+			else
+				m_poolEnergy->reset();
+			e = m_poolEnergy;
+		}
+		else
+			e = new EnergyT(size+m_labelcostCount, // poor guess at number of pairwise terms needed :(
+			                m_numNeighborsTotal+(m_labelcostCount?size+m_labelcostCount : 0),
+			                handleError);
 
-		e.add_variable(size);
+		e->add_variable(size);
 		m_beforeExpansionEnergy = 0;
 
 
 
-		if ( m_setupDataCostsExpansion   ) (this->*m_setupDataCostsExpansion  )(size,alpha_label,&e,activeSites); //1.5/7
-		if ( m_setupSmoothCostsExpansion ) (this->*m_setupSmoothCostsExpansion)(size,alpha_label,&e,activeSites); //1.5/7
+		if ( m_setupDataCostsExpansion   ) (this->*m_setupDataCostsExpansion  )(size,alpha_label,e,activeSites); //1.5/7
+		if ( m_setupSmoothCostsExpansion ) (this->*m_setupSmoothCostsExpansion)(size,alpha_label,e,activeSites); //1.5/7
 
-		EnergyType alphaCorrection = setupLabelCostsExpansion(size,alpha_label,&e,activeSites); 
+		EnergyType alphaCorrection = setupLabelCostsExpansion(size,alpha_label,e,activeSites); 
 
 		checkInterrupt();
-		afterExpansionEnergy = e.minimize() + alphaCorrection; //5/7
+		afterExpansionEnergy = e->minimize() + alphaCorrection; //5/7
 		checkInterrupt();
         //=============================
 
 		if ( afterExpansionEnergy < m_beforeExpansionEnergy )
-			(this->*m_applyNewLabeling)(&e,activeSites,size,alpha_label);
+			(this->*m_applyNewLabeling)(e,activeSites,size,alpha_label);
 
 		for ( SiteID i = 0; i < size; i++ )
 			m_lookupSiteVar[activeSites[i]] = -1; // restore m_lookupSite to all -1s
@@ -1260,10 +1523,68 @@ inline bool GCoptimization::alpha_expansion(LabelID alpha_label)
 	} 
 	catch (...)
 	{
-		delete [] activeSites;
+		if ( !m_pool ) { delete [] activeSites; delete e; }
+		throw;
+	}
+	if ( !m_pool ) { delete [] activeSites; delete e; }
+	return afterExpansionEnergy < m_beforeExpansionEnergy;
+}
+
+//-------------------------------------------------------------------
+// Dynamic mode: updates the capacities of the graph of the move and solves it. The search
+// trees of the previous maxflow on the graph are reused when at most a fraction
+// GCO_DYNAMIC_REUSE of the nodes were marked; past that, growing the trees again is cheaper.
+//
+bool GCoptimization::alpha_expansion_dynamic(LabelID alpha_label)
+{
+	finalizeNeighbors();
+	gcoclock_t ticks0 = gcoclock();
+
+	if ( m_stepsThisCycleTotal == 0 )
+		m_labelingInfoDirty = true; // if not inside expansion(), assume data cost function could have changed since last expansion
+	updateLabelingInfo();
+
+	DynamicGraph& g = m_dynamic[alpha_label % m_dynamicCount];
+	EnergyType constant = 0, afterExpansionEnergy = 0;
+	try
+	{
+		setupDynamicGraph(g);
+		m_beforeExpansionEnergy = 0;
+		g.changed = 0;
+		memset(g.marked,0,m_num_sites);
+		memset(g.unaryNext,0,m_num_sites*sizeof(EnergyTermType));
+		if ( m_setupDataCostsDynamic   ) (this->*m_setupDataCostsDynamic  )(g,alpha_label,constant);
+		if ( m_setupSmoothCostsDynamic ) (this->*m_setupSmoothCostsDynamic)(g,alpha_label,constant);
+
+		for ( SiteID i = 0; i < m_num_sites; i++ )
+		{
+			EnergyTermType delta = g.unaryNext[i] - g.unary[i];
+			if ( delta == 0 )
+				continue;
+			g.e->add_tweights(i,delta,0);
+			g.unary[i] = g.unaryNext[i];
+			markDynamicNode(g,i);
+		}
+
+		bool reuse = !g.fresh && g.changed <= GCO_DYNAMIC_REUSE*m_num_sites;
+		checkInterrupt();
+		afterExpansionEnergy = constant + g.e->maxflow(reuse);
+		checkInterrupt();
+		g.fresh = false;
+		g.moves++;
+		if ( reuse )
+			g.reused++;
+
+		if ( afterExpansionEnergy < m_beforeExpansionEnergy )
+			(this->*m_applyNewLabeling)(g.e,g.sites,m_num_sites,alpha_label);
+
+		printStatus2(alpha_label,-1,m_num_sites,ticks0);
+	}
+	catch (...)
+	{
+		g.clear(); // the capacities may be half updated
 		throw;
 	}
-	delete [] activeSites;
 	return afterExpansionEnergy < m_beforeExpansionEnergy;
 }
 
@@ -1419,6 +1740,16 @@ GCoptimizationGridGraph::GCoptimizationGridGraph(SiteID width, SiteID height,Lab
 	m_numNeighbors = new SiteID[m_num_sites];
 	m_neighbors = new SiteID[4*m_num_sites];
 
+	setupNeighbors();
+}
+
+//-------------------------------------------------------------------
+// Fills the full 4-neighbour lists of the grid
+
+void GCoptimizationGridGraph::setupNeighbors()
+{
+	m_numNeighborsTotal = 0;
+
 	SiteID indexes[4] = {-1,1,-m_width,m_width};
 
 	SiteID indexesL[3] = {1,-m_width,m_width};
@@ -1435,7 +1766,7 @@ GCoptimizationGridGraph::GCoptimizationGridGraph(SiteID width, SiteID height,Lab
 
 	setupNeighbData(1,m_height-1,0,1,3,indexesL);
 	setupNeighbData(1,m_height-1,m_width-1,m_width,3,indexesR);
-	setupNeighbData(0,1,1,width-1,3,indexesU);
+	setupNeighbData(0,1,1,m_width-1,3,indexesU);
 	setupNeighbData(m_height-1,m_height,1,m_width-1,3,indexesD);
 
 	setupNeighbData(0,1,0,1,2,indexesUL);
@@ -1486,8 +1817,35 @@ void GCoptimizationGridGraph::finalizeNeighbors()
 void GCoptimizationGridGraph::setSmoothCostVH(EnergyTermType *smoothArray, EnergyTermType *vCosts, EnergyTermType *hCosts)
 {
 	setSmoothCost(smoothArray);
+	setNeighborWeights(vCosts,hCosts,false);
+}
+
+//-------------------------------------------------------------------
+
+void GCoptimizationGridGraph::setNeighborWeights(EnergyTermType *vCosts, EnergyTermType *hCosts, bool dropZero)
+{
+	if (m_weightedGraph) delete [] m_neighborsWeights;
 	m_weightedGraph = 1;
+	setupNeighbors(); // edges dropped by an earlier call may have a weight now
 	computeNeighborWeights(vCosts,hCosts);
+	if ( !dropZero )
+		return;
+
+	// drop the zero-weight edges from the neighbor lists, so the moves never visit them
+	m_numNeighborsTotal = 0;
+	for ( SiteID i = 0; i < m_num_sites; i++ )
+	{
+		SiteID kept = 0;
+		for ( SiteID n = 0; n < m_numNeighbors[i]; n++ )
+			if ( m_neighborsWeights[4*i+n] != 0 )
+			{
+				m_neighbors[4*i+kept]        = m_neighbors[4*i+n];
+				m_neighborsWeights[4*i+kept] = m_neighborsWeights[4*i+n];
+				kept++;
+			}
+		m_numNeighbors[i] = kept;
+		m_numNeighborsTotal += kept;
+	}
 }
 
 //-------------------------------------------------------------------
@@ -142,6 +142,11 @@ extern "C" gcoclock_t GCO_CLOCKS_PER_SEC; // this variable will stay 0 until gco
                                      // the library will raise an exception
 #endif
 
+#ifndef GCO_DYNAMIC_REUSE
+#define GCO_DYNAMIC_REUSE 0.25       // in dynamic mode the search trees are reused when at most
+                                     // this fraction of the nodes changed since the last maxflow
+#endif
+
 #if defined(GCO_ENERGYTYPE) && !defined(GCO_ENERGYTERMTYPE)
 #define GCO_ENERGYTERMTYPE GCO_ENERGYTYPE
 #endif
@@ -220,6 +225,10 @@ public:
 		EnergyTermType cost;
 	};
 	void setDataCost(LabelID l, SparseDataCost *costs, SiteID count);
+	// Set costs for a subset of sites only, the others are free (cost 0 for every label).
+	// rowOfSite[s] is the row of site s in rows (num_labels costs each), -1 if s is free.
+	// Neither array is copied; free sites add no data terms to the moves.
+	void setDataCostRows(EnergyTermType *rows, SiteID *rowOfSite);
 
 	// Set cost for all (LabelID,LabelID) pairs; the actual smooth cost is then weighted
 	// at each pair of on neighbors. Defaults to Potts model (0 if l1==l2, 1 otherwise)
@@ -271,6 +280,45 @@ public:
 	//   2 => expansion-/swap-level output (label(s), current energy)
 	void setVerbosity(int level) { m_verbosity = level; }
 
+	// Pool mode: the graph and the active site list of the expansion moves are kept
+	// alive across moves and cycles and reset for the next move instead of freed.
+	void setPoolMode(bool enable);
+
+	// Dynamic mode: an expansion move runs on a graph over all sites whose capacities are
+	// updated from the previous move solved on it instead of rebuilt, marking only the nodes
+	// whose terms changed, so maxflow reuses its search trees when few of them did.
+	// g is an array of count graphs and the move of label l uses g[l%count]; with one graph
+	// per label a move is solved again where the same label was expanded last (the previous
+	// cycle, or the previous problem). The graphs belong to the caller and can be handed to
+	// the next problem with the same neighborhood system (e.g. the next frame of a video).
+	// NULL turns the mode off; it is ignored with label costs or sparse data costs.
+	struct DynamicGraph {
+		DynamicGraph();
+		~DynamicGraph();
+		void clear();              // frees the graph, the next move builds it again
+
+		EnergyT        *e;
+		SiteID          numSites;
+		SiteID          numEdges;
+		SiteID         *sites;     // identity list of the sites, to apply a move
+		SiteID         *edgeX;     // edge k joins edgeX[k] and edgeY[k] < edgeX[k] (arcs 2k and 2k+1)
+		SiteID         *edgeY;
+		EnergyTermType *edgeW;     // weight of edge k in the current problem
+		EnergyTermType *edgeCap;   // capacity of edgeX[k]->edgeY[k] represented in the graph
+		EnergyTermType *unary;     // unary term represented in the graph, paid when a site keeps its label
+		EnergyTermType *unaryNext; // unary term of the move being set up
+		bool            fresh;     // no maxflow has run on the graph yet
+		unsigned char  *marked;    // node marked for the move being set up
+		SiteID          changed;   // number of marked nodes
+		int             moves;     // moves solved on the graph
+		int             reused;    // moves solved reusing the search trees
+		int             builds;    // times the graph was built
+	private:
+		DynamicGraph(const DynamicGraph&);
+		DynamicGraph& operator=(const DynamicGraph&);
+	};
+	void setDynamicGraph(DynamicGraph* g, LabelID count=1);
+
 protected:
 	struct LabelCost {
 		~LabelCost() { delete [] labels; }
@@ -310,6 +358,11 @@ protected:
 	void*   m_datacostFn;
 	void*   m_smoothcostFn;
 	EnergyType m_beforeExpansionEnergy;
+	EnergyT *m_poolEnergy;          // graph of the moves in pool mode, NULL otherwise
+	SiteID  *m_poolActiveSites;     // active site list of the moves in pool mode
+	bool     m_pool;
+	DynamicGraph *m_dynamic;        // graphs of the moves in dynamic mode, NULL otherwise
+	LabelID  m_dynamicCount;
 
 	SiteID *m_numNeighbors;              // holds num of neighbors for each site
 	SiteID  m_numNeighborsTotal;         // holds total num of neighbor relationships
@@ -318,6 +371,8 @@ protected:
 	SiteID (GCoptimization::*m_queryActiveSitesExpansion)(LabelID, SiteID*);
 	void (GCoptimization::*m_setupDataCostsExpansion)(SiteID,LabelID,EnergyT*,SiteID*);
 	void (GCoptimization::*m_setupSmoothCostsExpansion)(SiteID,LabelID,EnergyT*,SiteID*);
+	void (GCoptimization::*m_setupDataCostsDynamic)(DynamicGraph&,LabelID,EnergyType&);
+	void (GCoptimization::*m_setupSmoothCostsDynamic)(DynamicGraph&,LabelID,EnergyType&);
 	void (GCoptimization::*m_setupDataCostsSwap)(SiteID,LabelID,LabelID,EnergyT*,SiteID*);
 	void (GCoptimization::*m_setupSmoothCostsSwap)(SiteID,LabelID,LabelID,EnergyT*,SiteID*);
 	void (GCoptimization::*m_applyNewLabeling)(EnergyT*,SiteID*,SiteID,LabelID);
@@ -340,6 +395,20 @@ protected:
 		const LabelID m_num_labels;
 	};
 
+	struct DataCostFnFromRows {
+		DataCostFnFromRows(EnergyTermType* theRows, SiteID* theRowOfSite, LabelID num_labels)
+			: m_rows(theRows), m_rowOfSite(theRowOfSite), m_num_labels(num_labels){}
+		OLGA_INLINE bool isFree(SiteID s){return m_rowOfSite[s] < 0;}
+		OLGA_INLINE EnergyTermType compute(SiteID s, LabelID l){
+			SiteID r = m_rowOfSite[s];
+			return r < 0 ? 0 : m_rows[(size_t)r*m_num_labels+l];
+		}
+	private:
+		const EnergyTermType* const m_rows;
+		const SiteID* const m_rowOfSite;
+		const LabelID m_num_labels;
+	};
+
 	struct DataCostFnFromFunction {
 		DataCostFnFromFunction(DataCostFn fn): m_fn(fn){}
 		OLGA_INLINE EnergyTermType compute(SiteID s, LabelID l){return m_fn(s,l);}
@@ -446,6 +515,8 @@ protected:
 	template <typename DataCostT>   void setupDataCostsExpansion(SiteID size,LabelID alpha_label,EnergyT *e,SiteID *activeSites);
 	template <typename DataCostT>   void setupDataCostsSwap(SiteID size,LabelID alpha_label,LabelID beta_label,EnergyT *e,SiteID *activeSites);
 	template <typename SmoothCostT> void setupSmoothCostsExpansion(SiteID size,LabelID alpha_label,EnergyT *e,SiteID *activeSites);
+	template <typename DataCostT>   void setupDataCostsDynamic(DynamicGraph& g,LabelID alpha_label,EnergyType& constant);
+	template <typename SmoothCostT> void setupSmoothCostsDynamic(DynamicGraph& g,LabelID alpha_label,EnergyType& constant);
 	template <typename SmoothCostT> void setupSmoothCostsSwap(SiteID size,LabelID alpha_label,LabelID beta_label,EnergyT *e,SiteID *activeSites);
 	template <typename DataCostT>   void applyNewLabeling(EnergyT *e,SiteID *activeSites,SiteID size,LabelID alpha_label);
 	template <typename DataCostT>   void updateLabelingDataCosts();
@@ -454,6 +525,9 @@ protected:
 
 	EnergyType setupLabelCostsExpansion(SiteID size,LabelID alpha_label,EnergyT *e,SiteID *activeSites);
 	void       updateLabelingInfo(bool updateCounts=true,bool updateActive=true,bool updateCosts=true);
+	void       setupDynamicGraph(DynamicGraph& g);
+	void       updateDynamicEdge(DynamicGraph& g,SiteID k,EnergyTermType cap);
+	void       markDynamicNode(DynamicGraph& g,SiteID i);
 	
 	// Check for overflow and submodularity issues when setting up binary graph cut
 	void addterm1_checked(EnergyT *e,VarID i,EnergyTermType e0,EnergyTermType e1);
@@ -470,6 +544,7 @@ protected:
 private:
 	// Peforms one iteration (one pass over all pairs of labels) of expansion/swap algorithm
 	EnergyType oneExpansionIteration();
+	bool alpha_expansion_dynamic(LabelID alpha_label);
 	EnergyType oneSwapIteration();
 	void printStatus1(const char* extraMsg=0);
 	void printStatus1(int cycle, bool isSwap, gcoclock_t ticks0);
@@ -537,6 +612,10 @@ public:
 	virtual ~GCoptimizationGridGraph();
 
 	void setSmoothCostVH(EnergyTermType *smoothArray, EnergyTermType *vCosts, EnergyTermType *hCosts);
+	// Spatially varying w_pq's without a smoothness table, so any setSmoothCost form can be used:
+	// hCosts[p] weights the edge (p,p+1), vCosts[p] the edge (p,p+width); edges of weight 0 are removed
+	// unless dropZero is false, which keeps the neighborhood system the same for any weights.
+	void setNeighborWeights(EnergyTermType *vCosts, EnergyTermType *hCosts, bool dropZero=true);
 
 protected:
 	virtual void giveNeighborInfo(SiteID site, SiteID *numSites, SiteID **neighbors, EnergyTermType **weights);
@@ -550,6 +629,7 @@ private:
 	SiteID *m_neighbors;                 // holds neighbor indexes
 	EnergyTermType *m_neighborsWeights;    // holds neighbor weights
 	
+	void setupNeighbors();
 	void setupNeighbData(SiteID startY,SiteID endY,SiteID startX,SiteID endX,SiteID maxInd,SiteID *indexes);
 	void computeNeighborWeights(EnergyTermType *vCosts,EnergyTermType *hCosts);
 };
@@ -141,6 +141,10 @@ public:
 	               Value E100, Value E101,
 	               Value E110, Value E111);
 
+	/* Removes all variables and terms, keeping the allocated
+	   storage for the next energy function */
+	void reset();
+
 	/* After the energy function has been constructed,
 	   call this function to minimize it.
 	   Returns the minimum of the function */
@@ -320,6 +324,9 @@ inline void Energy<captype,tcaptype,flowtype>::add_term3(Var x, Var y, Var z,
 	}
 }
 
+template <typename captype, typename tcaptype, typename flowtype> 
+inline void Energy<captype,tcaptype,flowtype>::reset() { GraphT::reset(); Econst = 0; }
+
 template <typename captype, typename tcaptype, typename flowtype> 
 inline typename Energy<captype,tcaptype,flowtype>::TotalValue Energy<captype,tcaptype,flowtype>::minimize() { 
 return Econst + GraphT::maxflow(); }
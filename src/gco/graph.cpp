@@ -11,6 +11,7 @@ template <typename captype, typename tcaptype, typename flowtype>
 	Graph<captype, tcaptype, flowtype>::Graph(int node_num_max, int edge_num_max, void (*err_function)(const char *))
 	: node_num(0),
 	  nodeptr_block(NULL),
+	  keep_nodeptr_block(false),
 	  error_function(err_function)
 {
 	if (node_num_max < 16) node_num_max = 16;
@@ -48,7 +49,7 @@ template <typename captype, typename tcaptype, typename flowtype>
 	arc_last = arcs;
 	node_num = 0;
 
-	if (nodeptr_block) 
+	if (nodeptr_block && !keep_nodeptr_block) 
 	{ 
 		delete nodeptr_block; 
 		nodeptr_block = NULL; 
@@ -142,6 +142,10 @@ public:
 	// (see functions below).
 	void reset();
 
+	// Keep the storage of the orphan lists between calls to maxflow() and reset(),
+	// so a graph reused for a sequence of problems allocates it only once.
+	void keep_blocks(bool keep) { keep_nodeptr_block = keep; }
+
 	////////////////////////////////////////////////////////////////////////////////
 	// 2. Functions for getting pointers to arcs and for reading graph structure. //
 	//    NOTE: adding new arcs may invalidate these pointers (if reallocation    //
@@ -299,6 +303,7 @@ private:
 	int					node_num;
 
 	DBlock<nodeptr>		*nodeptr_block;
+	bool				keep_nodeptr_block;
 
 	void	(*error_function)(const char *);	// this function is called if a error occurs,
 										// with a corresponding error message
@@ -593,7 +593,7 @@ template <typename captype, typename tcaptype, typename flowtype>
 	}
 	// test_consistency();
 
-	if (!reuse_trees || (maxflow_iteration % 64) == 0)
+	if ((!reuse_trees || (maxflow_iteration % 64) == 0) && !keep_nodeptr_block)
 	{
 		delete nodeptr_block; 
 		nodeptr_block = NULL; 
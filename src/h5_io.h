@@ -6,10 +6,21 @@
 #include <hdf5.h>
 #include <hdf5_hl.h>
 #include <opencv2/opencv.hpp>
+#include <mutex>
 
 using namespace std;
 using namespace cv;
 
+/**
+    Lock held around every use of a file handle: the serial HDF5 library is not
+    thread safe and the batch driver loads the next scene while one computes.
+*/
+std::mutex& h5_mutex(){
+
+    static std::mutex m;
+    return m;
+}
+
 /**
     Save Mat variable to HDF5 file.
     @file_name          File name to store
@@ -68,7 +79,7 @@ void  hdf52mat (const char* file_name,
 
 
    hid_t       file_id, dataset_id; 
-   file_id = H5Fopen(file_name, H5F_ACC_RDWR, H5P_DEFAULT);
+   file_id = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
    dataset_id = H5Dopen(file_id, file_dataset_name,H5P_DEFAULT);
 
    // Read the dataset. 
@@ -101,7 +112,7 @@ void load_hci_hdf5(const char* file_name,
 
    hid_t       file_id, dataset_id; 
 
-   file_id = H5Fopen(file_name, H5F_ACC_RDWR, H5P_DEFAULT);
+   file_id = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
    dataset_id = H5Dopen(file_id, dataset_name, H5P_DEFAULT);
 
    H5Dread(dataset_id, d_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, array);
@@ -109,6 +120,47 @@ void load_hci_hdf5(const char* file_name,
    H5Fclose(file_id);
 }
 
+/**
+    Load a block of views of a HCI dataset laid out [V][U][H][W](...) with a
+    hyperslab read, so only the selected views are read from the file.
+    The views [v0, v0+nv) x [u0, u0+nu) are stored one after the other.
+    @file_id            HDF5 file opened by the caller
+    @dataset_name       HDF5 Dataset name
+    @d_type             the type of data buffer
+    @v0 nv              first view row and number of view rows
+    @u0 nu              first view column and number of view columns
+    @array              data buffer of nv*nu views to be loaded
+*/
+template<class TYPE>
+void load_hci_views(hid_t file_id,
+                    const char* dataset_name,
+                    hid_t d_type,
+                    int v0, int nv,
+                    int u0, int nu,
+                    TYPE* array){
+
+   hid_t   dataset_id, file_space, mem_space;
+   hsize_t dims[8], start[8], count[8];
+
+   dataset_id = H5Dopen(file_id, dataset_name, H5P_DEFAULT);
+   file_space = H5Dget_space(dataset_id);
+   int rank   = H5Sget_simple_extent_dims(file_space, dims, NULL);
+
+   for (int n=0; n<rank; n++){
+       start[n] = 0;
+       count[n] = dims[n];
+   }
+   start[0] = v0; count[0] = nv;
+   start[1] = u0; count[1] = nu;
+   H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL);
+   mem_space = H5Screate_simple(rank, count, NULL);
+
+   H5Dread(dataset_id, d_type, mem_space, file_space, H5P_DEFAULT, array);
+   H5Sclose(mem_space);
+   H5Sclose(file_space);
+   H5Dclose(dataset_id);
+}
+
 /**
     Save 2D data buffer to HDF5 file.
     Usage: mem2hdf5  ("test.h5", "data", H5T_NATIVE_DOUBLE, w, h, (double *) ptr);
@@ -154,22 +206,88 @@ void  mem2hdf5      (const char* file_name,
 }
 
 
+/**
+    Save a 3D data buffer (rows x cols x depth) to a new dataset of an open HDF5
+    file, chunked and compressed with the byte shuffle and deflate filters.
+    @file_id            HDF5 file opened by the caller
+    @dataset_name       HDF5 Data set name
+    @d_type             H5T_NATIVE_FLOAT H5T_NATIVE_USHORT ...
+    @dims               rows, cols and depth of the buffer (depth 1 for a 2D map)
+    @chunk              chunk dimensions
+    @level              deflate level (0-9)
+    @ptr                data buffer pointer
+*/
+template<class TYPE>
+void mem2hdf5_chunked(hid_t file_id,
+                      const char* dataset_name,
+                      hid_t d_type,
+                      const hsize_t dims[3],
+                      const hsize_t chunk[3],
+                      int level,
+                      const TYPE* ptr){
+
+    hid_t dataspace = H5Screate_simple(3, dims, NULL);
+    hid_t dataset_config = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dataset_config, 3, chunk);
+    H5Pset_shuffle(dataset_config);
+    H5Pset_deflate(dataset_config, level);
+
+    hid_t dataset = H5Dcreate2(file_id, dataset_name, d_type, dataspace,
+                               H5P_DEFAULT, dataset_config, H5P_DEFAULT);
+    H5Dwrite(dataset, d_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, ptr);
+
+    H5Dclose(dataset);
+    H5Pclose(dataset_config);
+    H5Sclose(dataspace);
+}
+
+/**
+    Load a 3D dataset of an open HDF5 file if it exists with the expected dimensions.
+    @file_id            HDF5 file opened by the caller
+    @dataset_name       HDF5 Data set name
+    @d_type             the type of data buffer
+    @dims               expected rows, cols and depth
+    @ptr                data buffer to be loaded
+    @return             false if the dataset is missing or its dimensions differ
+*/
+template<class TYPE>
+bool hdf52mem(hid_t file_id,
+              const char* dataset_name,
+              hid_t d_type,
+              const hsize_t dims[3],
+              TYPE* ptr){
+
+    if (H5Lexists(file_id, dataset_name, H5P_DEFAULT)<=0)
+        return false;
+
+    hid_t dataset   = H5Dopen(file_id, dataset_name, H5P_DEFAULT);
+    hid_t dataspace = H5Dget_space(dataset);
+    hsize_t file_dims[3];
+    bool match = (H5Sget_simple_extent_ndims(dataspace)==3);
+    if (match){
+        H5Sget_simple_extent_dims(dataspace, file_dims, NULL);
+        match = (file_dims[0]==dims[0])&&(file_dims[1]==dims[1])&&(file_dims[2]==dims[2]);
+    }
+    if (match)
+        match = (H5Dread(dataset, d_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, ptr)>=0);
+
+    H5Sclose(dataspace);
+    H5Dclose(dataset);
+    return match;
+}
+
 /**
     Load attributes from HCI HDF5 file. It is a hack and only work for spefic parameters!
-    @file_name          File name to store
+    @file_id            HDF5 file opened by the caller
     @shift              attribute name
     @baseline           attribute name
     @focalLength        attribute name
 */
-void load_hdf5_attri(const char* file_name, 
+void load_hdf5_attri(hid_t file_id,
                      double& shift, 
                      double& baseline, 
                      double& focalLength){
 
-    hid_t       file_id;  /* identifiers */
-    /* Open an existing file. */
-    file_id = H5Fopen(file_name, H5F_ACC_RDWR, H5P_DEFAULT);
-
     hid_t attr_baseline = H5Aopen_by_name( file_id, "/", "dH", H5P_DEFAULT, H5P_DEFAULT );
     if ( attr_baseline >= 0 ) {
         H5Aread( attr_baseline, H5T_NATIVE_DOUBLE, &baseline );
@@ -182,6 +300,21 @@ void load_hdf5_attri(const char* file_name,
     if ( attr_shift >= 0 ) {
         H5Aread( attr_shift, H5T_NATIVE_DOUBLE, &shift );
     }
+    if ( attr_baseline >= 0 )    H5Aclose( attr_baseline );
+    if ( attr_focalLength >= 0 ) H5Aclose( attr_focalLength );
+    if ( attr_shift >= 0 )       H5Aclose( attr_shift );
+ }
+
+/**
+    Load attributes from HCI HDF5 file by name, see above.
+*/
+void load_hdf5_attri(const char* file_name, 
+                     double& shift, 
+                     double& baseline, 
+                     double& focalLength){
+
+    hid_t file_id = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
+    load_hdf5_attri(file_id, shift, baseline, focalLength);
     H5Fclose( file_id );
  }
 
@@ -5,18 +5,22 @@
 #include <limits>
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <omp.h>
 #include "WMF/JointWMF.h"
 #include "gco/GCoptimization.h"
 #include "light_field.h"
 #include "lf2depth_mrf.h"
 #include "volume_filtering.h"
+#include "cost_kernels.h"
+#include "cost_types.h"
+#include "cost_band.h"
+#include "cost_cache.h"
 #include "misc.h"
 
 #define DEBUG
 
 using namespace std;
 using namespace cv;
-float* d;
 
 /**
     final result filtering using fast Weighted Median Filter(WMF)
@@ -27,93 +31,67 @@ void depth_filtering(LF* lf_ptr){
     Mat img_grey;
     cvtColor(lf_ptr->imgc, img_grey, CV_RGB2GRAY);
     JointWMF wmf;
-    lf_ptr->depth_f=wmf.filter(lf_ptr->depth, img_grey, 5, 25.5, 64, 256, 1, "exp");//cos
+    int nI = lf_ptr->subpixel ? 8*lf_ptr->nlabels : lf_ptr->nlabels; //keep the sub-label part
+    nI = min(nI, 4096); //the filter holds three nI*256 int histograms, 12 MB at most
+    lf_ptr->depth_f=wmf.filter(lf_ptr->depth, img_grey, 5, 25.5, nI, 256, 1, "exp");//cos
     //medianBlur ( lf.depth, lf.depth_f, 5 );
 }
 
 /**
     Calculate the disparity cost per pixel
-    @img          EPI slice as input
-    @depth        depth cost as output
-    @depthc       depth confidence as output
+    @img          EPI view as input
+    @depth        depth cost as output (encoded with lf_ptr->q_cost)
+    @depthc       depth confidence as output (encoded with lf_ptr->q_mean)
+    @sweep        label sweep kernel
     @lf_ptr       light field structure pointer 
+    @scratch      2*img.cols*nlabels floats of reusable scratch, allocated per call if NULL
+    @stride       distance between the stacks of two EPI columns in the output, nlabels if 0
 */
-
-bool disparity_cost( const Mat& img,  float *depth, float *depthc,  LF* lf_ptr){
+template<typename T>
+bool disparity_cost( const epi_view& img,  T *depth, T *depthc, label_sweep_fn sweep, LF* lf_ptr,
+                     float* scratch = NULL, int stride = 0){
 	
-	Vec3f *data_ptr = (Vec3f*)(img.data); 	 
-	int cc = (lf_ptr->U-1)/2;
 	int nlabels = lf_ptr->nlabels;
-	float* depth_addr2  = new float[img.cols*lf_ptr->nlabels];//depth  + 3*lf_ptr->nlabels;
-	float* depth_addr3  = depth_addr2;
-	depth_addr2  =  depth_addr2  + 3*nlabels;
-	float* depthc_addr = depthc  + 3*nlabels;
-
-
-
-	for (int i=3; i<(img.cols-3); i++){
-     
-		float data_new[3], err[3];	    
- 
-		for (int k=0; k<nlabels; k++){ //-64 64
-  			
-			float tmp1[3] = {0,0,0}, tmp2[3] = {0,0,0};	
+	int r       = lf_ptr->window/2;
+	if (stride==0) stride = nlabels;
 
-		    for (int t=-3; t<=3; t++){
+	float* buffer       = scratch ? scratch : new float[2*img.cols*nlabels];
+	float* depth_addr3  = buffer;
+	float* mean_addr3   = buffer + img.cols*nlabels;
 
-				float xnew  = (i + d[k] * float(t));//(i + d * float(t))*8;				      	 
-		        int idx     = int(cc+t)*img.cols+int(xnew);
-			
-				float b = xnew- int(xnew);//bilinear interpolation
-				float a = 1 - b;		
+	sweep(img, lf_ptr->ctx->disp, nlabels, depth_addr3, mean_addr3);
 
-				for (int m=0; m<3; m++){
-					data_new[m] = data_ptr[idx][m]*a + data_ptr[idx+1][m]*b ;  
-					tmp1[m] = tmp1[m] + data_new[m];
-					tmp2[m] = tmp2[m] + data_new[m]*data_new[m];	           		                            		 
-				}
-			}
- 
-			for (int m=0; m<3; m++)
-				err[m] = tmp2[m] - tmp1[m]*tmp1[m]/7;
-					  	  
-			float err_max    = (err[0]  > err[1])? err[0]  : err[1];
-			*depth_addr2++   = (err_max > err[2])? err_max : err[2];
-	 		*depthc_addr++   =  (tmp1[0]+tmp1[1]+tmp1[2])/21;
-		}   		 			 
+	for (int i=r+1; i<(img.cols-r-1); i++){
+		T* depth_addr = depth + i*stride;
+		for (int k=0; k<nlabels; k++)
+			depth_addr[k] = cost_codec<T>::encode(depth_addr3[(i-1)*nlabels +k] + depth_addr3[i*nlabels +k] + depth_addr3[(i+1)*nlabels+k], lf_ptr->q_cost);
 	}
 
-
-	float* depth_addr  = depth  + 4*nlabels;
-
-	for (int i=4; i<(img.cols-4); i++)
+	for (int i=r; i<(img.cols-r); i++){
+		T* mean_addr = depthc + i*stride;
 		for (int k=0; k<nlabels; k++)
-			*depth_addr++   = depth_addr3[(i-1)*nlabels +k] + depth_addr3[i*nlabels +k] + depth_addr3[(i+1)*nlabels+k];
-
+			mean_addr[k] = cost_codec<T>::encode(mean_addr3[i*nlabels +k], lf_ptr->q_mean);
+	}
 
+	if (!scratch)
+		delete[] buffer;
     return true;
 }
 
 /**
-    Build the cost volume.
-    @epi_h         Horizontal EPI slices as input
-    @epi_v         Vertical   EPI slices as input
-    @depth_x       Horizontal cost volume
-    @depth_y       Vertical   cost volume
-    @depth_cx      Horizontal confidence volume
-    @depth_cy      Vertical   confidence volume
-    @lf_ptr        light field structure pointer         
+    Build the discrete label to disparity table of the context, lf_ptr->ctx->disp.
+    @lf_ptr        light field structure pointer
 */
-void cost_volume(     vector<Mat>& epi_h, 
-                	  vector<Mat>& epi_v,  
-                      float* depth_x,
-			          float* depth_y,
-                      float* depth_cx,
-			          float* depth_cy,			          
-                      LF* lf_ptr){
-    
+void disparity_table(LF* lf_ptr){
+
     //discrete depth value
-    d  = new float[lf_ptr->nlabels+1];   
+    lf_context* ctx = lf_ptr->ctx;
+    if (ctx->ndisp<(lf_ptr->nlabels+1)){
+        delete[] ctx->disp;
+        ctx->disp  = new float[lf_ptr->nlabels+1];
+        ctx->ndisp = lf_ptr->nlabels+1;
+    }
+    float* d = ctx->disp;
     
     float dmin=lf_ptr->d_min;
     float dmax=lf_ptr->d_max;   
@@ -121,35 +99,151 @@ void cost_volume(     vector<Mat>& epi_h,
 		d[k]= dmin+float(k)*(dmax-dmin)/float(lf_ptr->nlabels);
 	    //cout<<d[k]<<endl;	
     }
+}
+
+/**
+    Build the cost volume from the EPI views of the light field tensor.
+    @depth_x       Horizontal cost volume
+    @depth_y       Vertical   cost volume
+    @depth_cx      Horizontal confidence volume
+    @depth_cy      Vertical   confidence volume
+    @lf_ptr        light field structure pointer         
+*/
+template<typename T>
+void cost_volume(     T* depth_x,
+			          T* depth_y,
+                      T* depth_cx,
+			          T* depth_cy,			          
+                      LF* lf_ptr){
+    
+    int width   = lf_ptr->W;
+    int height  = lf_ptr->H;
+    int nlabels = lf_ptr->nlabels;
+
+    disparity_table(lf_ptr);
+    label_sweep_fn sweep = select_label_sweep(lf_ptr);
+
+    int64 t0, t1;
 
     //=============Horizontal==================
-    #pragma omp parallel for
-	for (int j = 0; j < lf_ptr->H; j++){ 
-		int offset = lf_ptr->nlabels*j*lf_ptr->W;
-		disparity_cost( epi_h[j], depth_x+offset, depth_cx+lf_ptr->nlabels*j*lf_ptr->W, lf_ptr);
-	}
-	cout<<" Extracting Horizontal EPI Slices Done"<<endl;
+    t0 = cv::getTickCount();
+    #pragma omp parallel
+    {
+        float *scratch = new float[2*width*nlabels];
+
+        #pragma omp for
+        for (int j = 0; j < height; j++){ 
+            int offset = nlabels*j*width;
+            disparity_cost( epi_h(lf_ptr, j), depth_x+offset, depth_cx+offset, sweep, lf_ptr, scratch);
+        }
+        delete[] scratch;
+    }
+    t1 = cv::getTickCount();
+	cout<<" Extracting Horizontal EPI Slices Done "<<(t1-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
 
     //==============Vertical=====================
-    #pragma omp parallel for
-	for (int i = 0; i < lf_ptr->W; i++) {
-		
-        float *depth_array           =  (float*) calloc (lf_ptr->nlabels*lf_ptr->W, sizeof(float)); 
-	    float *con_array             =  (float*) calloc (lf_ptr->nlabels*lf_ptr->W, sizeof(float)); 	         
-            
-        disparity_cost( epi_v[i], depth_array, con_array, lf_ptr);
-			
-		for (int j = 0; j < lf_ptr->H; j++){	
-		int idx = j*lf_ptr->W+i;			    
-	    memcpy(depth_y  + lf_ptr->nlabels*(idx), depth_array+ j*lf_ptr->nlabels, lf_ptr->nlabels * sizeof(float));
-	    memcpy(depth_cy + lf_ptr->nlabels*(idx), con_array  + j*lf_ptr->nlabels, lf_ptr->nlabels * sizeof(float));		    
+    //Tiles of adjacent columns. The tile buffer is laid out as [row][column][label],
+    //which is the order of depth_y, so each row of a tile is stored with a single
+    //contiguous copy instead of one strided copy per pixel.
+    const int tile = 8;
+    t0 = cv::getTickCount();
+    #pragma omp parallel
+    {
+        T *depth_tile  = (T*) calloc (tile*height*nlabels, sizeof(T));
+        T *con_tile    = (T*) calloc (tile*height*nlabels, sizeof(T));
+        float *scratch = new float[2*height*nlabels];
+
+        #pragma omp for schedule(dynamic)
+        for (int i0 = 0; i0 < width; i0 += tile){
+
+            int n = min(tile, width-i0);
+            for (int c = 0; c < n; c++)
+                disparity_cost( epi_v(lf_ptr, i0+c), depth_tile+c*nlabels, con_tile+c*nlabels, sweep, lf_ptr, scratch, tile*nlabels);
+
+            for (int j = 0; j < height; j++){
+                int idx = j*width+i0;
+                memcpy(depth_y  + nlabels*idx, depth_tile + j*tile*nlabels, n*nlabels*sizeof(T));
+                memcpy(depth_cy + nlabels*idx, con_tile   + j*tile*nlabels, n*nlabels*sizeof(T));
+            }
         }
+        free(depth_tile);
+        free(con_tile);
+        delete[] scratch;
+    }
+    t1 = cv::getTickCount();
+	cout<<" Extracting Vertical   EPI Slices Done "<<(t1-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+}
 
-        delete[] depth_array;
-        delete[] con_array;
-	}
-	cout<<" Extracting Vertical   EPI Slices Done"<<endl;
-    
+/**
+    Coarse-to-fine version of cost_volume. The EPI cost is swept on every
+    c2f_step-th label first; each pixel then keeps a band of full resolution
+    labels around its coarse minimum and only that band is evaluated.
+    @band_x        Horizontal banded volume as output
+    @band_y        Vertical   banded volume as output
+    @lf_ptr        light field structure pointer
+*/
+template<typename T>
+void cost_volume_band(band_volume<T>& band_x, band_volume<T>& band_y, LF* lf_ptr){
+
+    int width   = lf_ptr->W;
+    int height  = lf_ptr->H;
+    int nlabels = lf_ptr->nlabels;
+
+    disparity_table(lf_ptr);
+    label_sweep_fn sweep = select_label_sweep(lf_ptr);
+    label_range_fn range = select_label_range(lf_ptr);
+
+    band_init(band_x, width*height, lf_ptr);
+    band_init(band_y, width*height, lf_ptr);
+    const float* d = lf_ptr->ctx->disp;
+    int ncoarse = band_x.ncoarse;
+    vector<float> dc(ncoarse);
+    for (int c = 0; c < ncoarse; c++)
+        dc[c] = d[c*lf_ptr->c2f_step];
+
+    int64 t0, t1;
+    long evals = 0;
+
+    //=============Coarse labels==================
+    t0 = cv::getTickCount();
+    #pragma omp parallel
+    {
+        float *scratch = new float[2*max(width, height)*ncoarse];
+
+        #pragma omp for nowait
+        for (int j = 0; j < height; j++)
+            band_coarse_line(epi_h(lf_ptr, j), &dc[0], sweep, scratch, band_x, j*width, 1, lf_ptr);
+        #pragma omp for
+        for (int i = 0; i < width; i++)
+            band_coarse_line(epi_v(lf_ptr, i), &dc[0], sweep, scratch, band_y, i, width, lf_ptr);
+        delete[] scratch;
+    }
+    band_alloc(band_x);
+    band_alloc(band_y);
+    t1 = cv::getTickCount();
+    cout<<" Coarse label sweep ("<<ncoarse<<" labels) Done "<<(t1-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+
+    //=============Fine label bands===============
+    t0 = cv::getTickCount();
+    #pragma omp parallel reduction(+:evals)
+    {
+        float *scratch = new float[2*max(width, height)*nlabels];
+
+        #pragma omp for nowait
+        for (int j = 0; j < height; j++)
+            evals += band_fine_line(epi_h(lf_ptr, j), d, range, scratch, band_x, j*width, 1, lf_ptr);
+        #pragma omp for
+        for (int i = 0; i < width; i++)
+            evals += band_fine_line(epi_v(lf_ptr, i), d, range, scratch, band_y, i, width, lf_ptr);
+        delete[] scratch;
+    }
+    t1 = cv::getTickCount();
+    cout<<" Fine label bands Done "<<(t1-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+
+    int r = lf_ptr->window/2;
+    double full = 2.0*nlabels*(double(height)*(width-2*r) + double(width)*(height-2*r));
+    double done = evals + 2.0*ncoarse*(double(height)*(width-2*r) + double(width)*(height-2*r));
+    cout<<" Cost evaluations: "<<100*done/full<<"% of the full sweep"<<endl;
 }
 
 /**
@@ -158,7 +252,8 @@ void cost_volume(     vector<Mat>& epi_h,
     @data_best     The disparity map as output
     @lf_ptr        light field structure pointer         
 */
-bool depth_optimal( float* data, uchar* data_best, LF* lf_ptr){
+template<typename LabelT>
+bool depth_optimal( float* data, LabelT* data_best, LF* lf_ptr){
 
 	for (int i=0; i<lf_ptr->W*lf_ptr->H; i++){	
 					
@@ -183,47 +278,108 @@ bool depth_optimal( float* data, uchar* data_best, LF* lf_ptr){
 }
 
 /*
-    Brute-force searching the optimal slope (depth) for a pixel.
+    Statistics of a cost stack in its encoded units: the minimum, the sum, the
+    first label at the minimum (num if none) and the number of labels above the
+    average. Both passes are branch free so the compiler vectorizes them.
     @data         A single stack for one pixel
     @num          The number of layer for the stack (volume)
-    @idx          The optimal slope index
-    @score        The score for the optimal slope           
 */
-bool depth_optimal_pixel(float* data, int num, int& idx, float& score, float& ratio){
+template<typename T>
+void stack_stats(const T* data, int num, float& value_min, float& sum, int& first, int& cnt){
 
-    idx = 0;
-    float avg=0;
-    float value_min=100000;
-    float value_max=0;
-    //float diff=0;
-    
+    sum = 0;
+    value_min = 100000;
     for (int k=0; k<num; k++){
+        float v = cost_codec<T>::decode(data[k], 1.0f);
+        sum = sum + v;
+        value_min = (v<value_min) ? v : value_min;
+    }
 
-        avg = avg + data[k];
+    float avg = sum/num;
+    cnt   = 0;
+    first = num;
+    for (int k=0; k<num; k++){
+        float v = cost_codec<T>::decode(data[k], 1.0f);
+        cnt  += (v>avg);
+        first = min(first, (v==value_min) ? k : num);
+    }
+}
 
-        if (value_min>data[k]){
-            value_min=data[k];
-            idx = k;
-        }
-        if (value_max<data[k]){
-            value_max=data[k]; 
-        }   
+/*
+    Float stacks go through the AVX2 reduction when the CPU has it.
+*/
+void stack_stats(const float* data, int num, float& value_min, float& sum, int& first, int& cnt){
+
+#ifdef LF_COST_SIMD
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if (avx2){
+        stack_stats_avx2(data, num, value_min, sum, first, cnt);
+        return;
     }
+#endif
+    stack_stats<float>(data, num, value_min, sum, first, cnt);
+}
+
+/*
+    Brute-force searching the optimal slope (depth) for a pixel. The stack is read
+    in its encoded units: the index, score and ratio do not depend on the scale.
+    @data         A single stack for one pixel
+    @num          The number of layer for the stack (volume)
+    @idx          The optimal slope index
+    @score        The score for the optimal slope           
+*/
+template<typename T>
+bool depth_optimal_pixel(const T* data, int num, int& idx, float& score, float& ratio){
+
+    float sum, value_min;
+    int first, cnt;
+    stack_stats(data, num, value_min, sum, first, cnt);
 
     //find the total number o pixels that larger than average value
-    int cnt = 0;
-    avg = avg/num;
-    for (int k=0; k<num; k++){
-        if (data[k]>avg)
-        cnt++;
-    }
+    float avg = sum/num;
+    idx   = (first<num) ? first : 0;
     ratio = (float)cnt/(float)num;
     score = avg/value_min;//float(cnt) / float(num);
-    //cout<<avg<<" "<<value_min<<" "<<score<<endl;
 
 return 0;//
 }
 
+/*
+    Optimal slope of a pixel and its confidence: the change of the mean along
+    the EPI line at the optimal slope, zero if the cost stack is not reliable.
+    @data         cost stack of the pixel
+    @conf         mean stack of the pixel
+    @conf_prev    mean stack of the previous pixel on the EPI line
+    @num          The number of layer for the stack (volume)
+    @idx          The optimal slope index
+    @scale        encoding scale of the mean stacks
+*/
+template<typename T>
+float slope_pixel(T* data, T* conf, T* conf_prev, int num, int& idx, float scale){
+
+    float score, ratio;
+    depth_optimal_pixel(data, num, idx, score, ratio);
+    float c = fabs(cost_codec<T>::decode(conf[idx], scale)-cost_codec<T>::decode(conf_prev[idx], scale));
+    return ((score>2.5)&&(ratio>0.4)) ? c : 0;
+}
+
+/*
+    Sub-label offset of the optimal slope of a pixel.
+    @data         cost stack of the pixel
+    @num          The number of layer for the stack (volume)
+    @idx          The optimal slope index
+    @mode         lf_ptr->subpixel
+*/
+template<typename T>
+float subpixel_stack(const T* data, int num, int idx, int mode){
+
+    if ((mode==0)||(idx<=0)||(idx>=(num-1)))
+        return 0;
+    return subpixel_offset(cost_codec<T>::decode(data[idx-1], 1.0f),
+                           cost_codec<T>::decode(data[idx],   1.0f),
+                           cost_codec<T>::decode(data[idx+1], 1.0f), mode);
+}
+
 /**
     Find the optimal disparity(depth) per pixel to produce the disaprity map
     based on the horizontal and vertical volume stacks.
@@ -234,55 +390,215 @@ return 0;//
     @cf1     the horizontal image (average) 
     @cf2     the vertical   image (average)       
     @data_best  the 2D disaprity
+    @data_sub   sub-label offset of data_best (lf_ptr->subpixel), may be NULL
     @lf_ptr  the light field structure pointer
 */
-bool compute_slope_xy( float* data1, float* data2,
-                 float* conf1, float* conf2, 
+template<typename T, typename LabelT>
+bool compute_slope_xy( T* data1, T* data2,
+                 T* conf1, T* conf2, 
                  float* cf1,   float* cf2,  
-                 uchar* data_best,                                                  
+                 LabelT* data_best, float* data_sub,
                  LF* lf_ptr){
 
     int height =  lf_ptr->H;
     int width  =  lf_ptr->W;
     int labels =  lf_ptr->nlabels;
 
-    int cnt=0;
-    float score[2], ratio[2];
-
+    #pragma omp parallel for schedule(dynamic)
     for (int j=0; j< height; j++){
 	    for (int i=0; i< width; i++){
-	    	
+
+	    	int cnt = j*width+i;
 	    	if ((j>0)&&(i>0)&&(j<(height-1))&&(i<(width-1))){    					   
 
                 int idx[2]    ={0,0};                   
                 
-                depth_optimal_pixel(&data1[cnt*labels], labels, idx[0], score[0], ratio[0]);
-                depth_optimal_pixel(&data2[cnt*labels], labels, idx[1], score[1], ratio[1]); 
-                
-                int offsetx0  = cnt*labels +idx[0];
-                int offsetx1 = (    j*width+i-1)*labels +idx[0];  
-
-                int offsety0  = cnt*labels +idx[1];            
-                int offsety1 = ((j-1)*width+i)*labels   +idx[1];
-
-
-                float cx1 = fabs(conf1[offsetx0]-conf1[offsetx1]);
-                float cy1 = fabs(conf2[offsety0]-conf2[offsety1]);           
-				
-				cf1[cnt]      = ((score[0]>2.5)&&(ratio[0]>0.4)) ? cx1 : 0;//=================
-				cf2[cnt]      = ((score[1]>2.5)&&(ratio[1]>0.4)) ? cy1 : 0;//=================
+                cf1[cnt] = slope_pixel(&data1[cnt*labels], &conf1[cnt*labels], &conf1[(    j*width+i-1)*labels], labels, idx[0], lf_ptr->q_mean);
+                cf2[cnt] = slope_pixel(&data2[cnt*labels], &conf2[cnt*labels], &conf2[((j-1)*width+i)*labels], labels, idx[1], lf_ptr->q_mean);
 				
 				if (cf1[cnt]>0)
 					data_best[j*width+i] = idx[0];
 				if (cf2[cnt]>cf1[cnt])
 					data_best[j*width+i] = idx[1];
+
+				if (data_sub&&(cf1[cnt]>0)&&(cf2[cnt]<=cf1[cnt]))
+					data_sub[cnt] = subpixel_stack(&data1[cnt*labels], labels, idx[0], lf_ptr->subpixel);
+				else if (data_sub&&(cf2[cnt]>cf1[cnt]))
+					data_sub[cnt] = subpixel_stack(&data2[cnt*labels], labels, idx[1], lf_ptr->subpixel);
             }
-            cnt++;                
         }                     
 	}
 	return true;
 }
 
+/*
+    Optimal slope of a pixel from a banded volume: the reliability test runs on
+    the coarse stack, the optimal label is searched inside the band.
+    @vol          banded volume
+    @idx          pixel index
+    @scale        encoding scale of the mean stacks
+    @k            The optimal slope index
+    @sub          sub-label offset of k, 0 on the edges of the band
+    @mode         lf_ptr->subpixel
+*/
+template<typename T>
+float slope_band(const band_volume<T>& vol, int idx, float scale, int& k, float& sub, int mode){
+
+    int kc;
+    float score, ratio;
+    depth_optimal_pixel(&vol.coarse[idx*vol.ncoarse], vol.ncoarse, kc, score, ratio);
+
+    int o = vol.offset[idx];
+    int b = 0;
+    float value_min = FLT_MAX;
+    for (int n = 0; n < vol.len[idx]; n++){
+        float v = cost_codec<T>::decode(vol.cost[o+n], 1.0f);
+        if (value_min>v){
+            value_min = v;
+            b = n;
+        }
+    }
+    k = vol.k0[idx] + b;
+    sub = 0;
+    if ((mode>0)&&(b>0)&&(b<(vol.len[idx]-1)))
+        sub = subpixel_offset(cost_codec<T>::decode(vol.cost[o+b-1], 1.0f), value_min,
+                              cost_codec<T>::decode(vol.cost[o+b+1], 1.0f), mode);
+    float c = fabs(cost_codec<T>::decode(vol.mean[o+b], scale)-cost_codec<T>::decode(vol.mean_prev[o+b], scale));
+    return ((score>2.5)&&(ratio>0.4)) ? c : 0;
+}
+
+/**
+    compute_slope_xy on the banded volumes of the coarse-to-fine search.
+    @band_x  the horizontal banded volume
+    @band_y  the vertical   banded volume
+    @cf1     the horizontal image (average)
+    @cf2     the vertical   image (average)
+    @data_best  the 2D disaprity
+    @data_sub   sub-label offset of data_best (lf_ptr->subpixel), may be NULL
+    @lf_ptr  the light field structure pointer
+*/
+template<typename T, typename LabelT>
+bool compute_slope_xy_band(const band_volume<T>& band_x, const band_volume<T>& band_y,
+                           float* cf1, float* cf2, LabelT* data_best, float* data_sub, LF* lf_ptr){
+
+    int height =  lf_ptr->H;
+    int width  =  lf_ptr->W;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int j=1; j<(height-1); j++)
+        for (int i=1; i<(width-1); i++){
+
+            int cnt       = j*width+i;
+            int idx[2]    = {0,0};
+            float sub[2]  = {0,0};
+
+            cf1[cnt] = slope_band(band_x, cnt, lf_ptr->q_mean, idx[0], sub[0], lf_ptr->subpixel);
+            cf2[cnt] = slope_band(band_y, cnt, lf_ptr->q_mean, idx[1], sub[1], lf_ptr->subpixel);
+
+            if (cf1[cnt]>0)
+                data_best[cnt] = idx[0];
+            if (cf2[cnt]>cf1[cnt])
+                data_best[cnt] = idx[1];
+
+            if (data_sub&&(cf1[cnt]>0)&&(cf2[cnt]<=cf1[cnt]))
+                data_sub[cnt] = sub[0];
+            else if (data_sub&&(cf2[cnt]>cf1[cnt]))
+                data_sub[cnt] = sub[1];
+        }
+    return true;
+}
+
+/**
+    Fused streaming version of cost_volume + compute_slope_xy. Each EPI line is
+    reduced to its optimal slope and confidence right after its cost is built,
+    so only one line of cost per thread is alive instead of the four volumes.
+    @cf1        the horizontal confidence image as output
+    @cf2        the vertical   confidence image as output
+    @data_best  the 2D disaprity as output
+    @data_sub   sub-label offset of data_best as output (lf_ptr->subpixel), may be NULL
+    @lf_ptr     the light field structure pointer
+*/
+template<typename LabelT>
+void cost_volume_fused(float* cf1, float* cf2, LabelT* data_best, float* data_sub, LF* lf_ptr){
+
+    int height =  lf_ptr->H;
+    int width  =  lf_ptr->W;
+    int labels =  lf_ptr->nlabels;
+
+    disparity_table(lf_ptr);
+    label_sweep_fn sweep = select_label_sweep(lf_ptr);
+
+    LabelT *idx_x = (LabelT*) calloc (width*height, sizeof(LabelT));
+    LabelT *idx_y = (LabelT*) calloc (width*height, sizeof(LabelT));
+    float  *sub_x = (float*)  calloc (width*height, sizeof(float));
+    float  *sub_y = (float*)  calloc (width*height, sizeof(float));
+
+    //=============Horizontal==================
+    #pragma omp parallel
+    {
+        float *cost = (float*) calloc (width*labels, sizeof(float));
+        float *conf = (float*) calloc (width*labels, sizeof(float));
+        float *scratch = new float[2*width*labels];
+
+        #pragma omp for
+        for (int j = 1; j < height-1; j++){
+            disparity_cost( epi_h(lf_ptr, j), cost, conf, sweep, lf_ptr, scratch);
+            for (int i = 1; i < width-1; i++){
+                int idx;
+                cf1[j*width+i]   = slope_pixel(cost+i*labels, conf+i*labels, conf+(i-1)*labels, labels, idx, 1.0f);
+                idx_x[j*width+i] = idx;
+                sub_x[j*width+i] = subpixel_stack(cost+i*labels, labels, idx, lf_ptr->subpixel);
+            }
+        }
+        free(cost);
+        free(conf);
+        delete[] scratch;
+    }
+	cout<<" Extracting Horizontal EPI Slices Done"<<endl;
+
+    //==============Vertical=====================
+    #pragma omp parallel
+    {
+        float *cost = (float*) calloc (height*labels, sizeof(float));
+        float *conf = (float*) calloc (height*labels, sizeof(float));
+        float *scratch = new float[2*height*labels];
+
+        #pragma omp for
+        for (int i = 1; i < width-1; i++){
+            disparity_cost( epi_v(lf_ptr, i), cost, conf, sweep, lf_ptr, scratch);
+            for (int j = 1; j < height-1; j++){
+                int idx;
+                cf2[j*width+i]   = slope_pixel(cost+j*labels, conf+j*labels, conf+(j-1)*labels, labels, idx, 1.0f);
+                idx_y[j*width+i] = idx;
+                sub_y[j*width+i] = subpixel_stack(cost+j*labels, labels, idx, lf_ptr->subpixel);
+            }
+        }
+        free(cost);
+        free(conf);
+        delete[] scratch;
+    }
+	cout<<" Extracting Vertical   EPI Slices Done"<<endl;
+
+    for (int j = 1; j < height-1; j++)
+        for (int i = 1; i < width-1; i++){
+            int c = j*width+i;
+            if (cf1[c]>0)
+                data_best[c] = idx_x[c];
+            if (cf2[c]>cf1[c])
+                data_best[c] = idx_y[c];
+
+            if (data_sub&&(cf1[c]>0)&&(cf2[c]<=cf1[c]))
+                data_sub[c] = sub_x[c];
+            else if (data_sub&&(cf2[c]>cf1[c]))
+                data_sub[c] = sub_y[c];
+        }
+
+    free(idx_x);
+    free(idx_y);
+    free(sub_x);
+    free(sub_y);
+}
+
 void spatial_filtering(float* confidence_x, float* confidence_y,  LF* lf_ptr){
 
 	int width  = lf_ptr->W;
@@ -335,82 +651,247 @@ void spatial_filtering(float* confidence_x, float* confidence_y,  LF* lf_ptr){
 
 
 /**
-    Extact the depth from horizontal and vertical EPI slices
-    @epi_h    horizontal EPI slices as input
-    @epi_v    vertical   EPI slices as input
+    Estimate the disparity map with cost volumes of element type T and label maps
+    of type LabelT: fused streaming or full volumes, spatial filtering and the MRF
+    refinement for Lytro.
     @lf_ptr   the light field structure pointer
-    @depth    the final result
 */
-bool lf2depth(LF* lf_ptr){
+template<typename T, typename LabelT>
+void lf2depth_estimate(LF* lf_ptr){
 
     int width  = lf_ptr->W;
     int height = lf_ptr->H;
     int num_pixels = width*height;
     int num_labels = lf_ptr->nlabels;
 
-    if (lf_ptr->type==0){ //HCI
-        lf_ptr->d_min=lf_ptr->dt_min;
-        lf_ptr->d_max=lf_ptr->dt_max;
+    //quantization scales of the cost and mean volumes
+    if (!cost_codec<T>::quantized){
+        lf_ptr->q_cost = 1;
+        lf_ptr->q_mean = 1;
+    }
+    else {
+        lf_ptr->q_cost = lf_ptr->cost_scale>0 ? lf_ptr->cost_scale : cost_scale_auto<T>(lf_ptr->window);
+        lf_ptr->q_mean = cost_codec<T>::max_value()/255.0f;
+    }
+    cout<<" Cost volume: "<<cost_codec<T>::name()<<" (scale "<<lf_ptr->q_cost<<")"<<endl;
+
+    T *depth_x          = NULL;
+    T *depth_y          = NULL;
+    T *depth_cx         = NULL;
+    T *depth_cy         = NULL;
+    float *confidence_x = (float*) pool_alloc (lf_ptr, LF_POOL_CONF_X, num_pixels*sizeof(float)); 
+    float *confidence_y = (float*) pool_alloc (lf_ptr, LF_POOL_CONF_Y, num_pixels*sizeof(float)); 
+    LabelT *depth_best_xy = new LabelT[num_pixels];
+    float  *depth_sub     = lf_ptr->subpixel ? (float*) calloc (num_pixels, sizeof(float)) : NULL;
+    band_volume<T> band_x, band_y;
+    bool banded = (lf_ptr->pipeline==0)&&(lf_ptr->c2f_step>1);
+
+    //cost cache: the merged volume the MRF reads plus the maps of the cost stage
+    string cache = (lf_ptr->pipeline==0) ? cost_cache_path(lf_ptr, cost_codec<T>::name()) : string();
+    float *merged = cache.empty() ? NULL : (float*) pool_alloc(lf_ptr, LF_POOL_MERGED, size_t(num_pixels)*num_labels*sizeof(float));
+    bool cached   = merged && cost_cache_load(cache, merged, confidence_x, confidence_y, depth_best_xy, depth_sub, lf_ptr);
+    if ((!cached)&&lf_ptr->lf.row.empty()&&lf_ptr->lf.row8.empty()){ //found by cost_cache_probe, unreadable since
+        cout<<" Cost cache: cannot load "<<cache<<" and the input was not decoded"<<endl;
+        pool_free(lf_ptr, merged);
+        pool_free(lf_ptr, confidence_x);
+        pool_free(lf_ptr, confidence_y);
+        free(depth_sub);
+        delete[] depth_best_xy;
+        return;
     }
-    if (fabs(lf_ptr->d_min-lf_ptr->d_max)>2)
-        lf_ptr->nlabels=64;
-    else
-        lf_ptr->nlabels=64;
-    num_labels = lf_ptr->nlabels;
-
-    float *depth_x      = new float[num_pixels*num_labels];
-    float *depth_y      = new float[num_pixels*num_labels];
-    float *depth_cx     = new float[num_pixels*num_labels];
-    float *depth_cy     = new float[num_pixels*num_labels];
-    float *confidence_x = (float*) calloc (num_pixels, sizeof(float)); 
-    float *confidence_y = (float*) calloc (num_pixels, sizeof(float)); 
-    uchar *depth_best_x = (uchar*) calloc (num_pixels, sizeof(uchar)); 
-    uchar *depth_best_y = (uchar*) calloc (num_pixels, sizeof(uchar)); 
-    uchar *depth_best_xy  = new uchar[num_pixels];
 
     int64 t0, t1;
     t0 = cv::getTickCount();
-    cost_volume(lf_ptr->epi_h, lf_ptr->epi_v, depth_x, depth_y, depth_cx, depth_cy, lf_ptr); //build the cost volume
-    compute_slope_xy    (depth_x, depth_y, depth_cx, depth_cy, confidence_x, confidence_y, depth_best_xy, lf_ptr);//===xy estimate
+    if (cached){ //straight to the spatial filtering and the MRF
+    }
+    else if (lf_ptr->pipeline==1){ //fused streaming winner-take-all, the volumes are never built
+        cost_volume_fused(confidence_x, confidence_y, depth_best_xy, depth_sub, lf_ptr);
+    }
+    else if (banded){ //coarse-to-fine search, full resolution labels only on a band per pixel
+        cost_volume_band(band_x, band_y, lf_ptr);
+        int64 t2 = cv::getTickCount();
+        compute_slope_xy_band(band_x, band_y, confidence_x, confidence_y, depth_best_xy, depth_sub, lf_ptr);
+        cout<<" Slope selection Done "<<(cv::getTickCount()-t2)/cv::getTickFrequency()<<" Seconds"<<endl;
+    }
+    else {
+        size_t bytes = size_t(num_pixels)*num_labels*sizeof(T);
+        depth_x      = (T*) pool_alloc(lf_ptr, LF_POOL_COST_X, bytes);
+        depth_y      = (T*) pool_alloc(lf_ptr, LF_POOL_COST_Y, bytes);
+        depth_cx     = (T*) pool_alloc(lf_ptr, LF_POOL_MEAN_X, bytes);
+        depth_cy     = (T*) pool_alloc(lf_ptr, LF_POOL_MEAN_Y, bytes);
+        cost_volume(depth_x, depth_y, depth_cx, depth_cy, lf_ptr); //build the cost volume
+        int64 t2 = cv::getTickCount();
+        compute_slope_xy    (depth_x, depth_y, depth_cx, depth_cy, confidence_x, confidence_y, depth_best_xy, depth_sub, lf_ptr);//===xy estimate
+        pool_release_slot(lf_ptr, LF_POOL_MEAN_X, depth_cx); //the mean volumes are not read after the slope selection
+        pool_release_slot(lf_ptr, LF_POOL_MEAN_Y, depth_cy);
+        depth_cx = depth_cy = NULL;
+        cout<<" Slope selection Done "<<(cv::getTickCount()-t2)/cv::getTickFrequency()<<" Seconds"<<endl;
+    }
+
+    //merged before the spatial filtering, which depends on THRESHOLD
+    if (merged && !cached){
+        if (banded)
+            volume_merge(band_x, band_y, confidence_x, confidence_y, merged, lf_ptr);
+        else
+            volume_merge(dense_volume<T>(depth_x, num_labels, lf_ptr->q_cost),
+                         dense_volume<T>(depth_y, num_labels, lf_ptr->q_cost), confidence_x, confidence_y, merged, lf_ptr);
+        cost_cache_save(cache, merged, confidence_x, confidence_y, depth_best_xy, depth_sub, lf_ptr);
+    }
     spatial_filtering(confidence_x, confidence_y, lf_ptr);
 
+    //confidence of the selected direction, the map returned next to the depth
+    if ((lf_ptr->confidence.rows==height)&&(lf_ptr->confidence.cols==width)){
+        float* conf = lf_ptr->confidence.ptr<float>(0);
+        for (int idx=0; idx<num_pixels; idx++)
+            conf[idx] = max(confidence_x[idx], confidence_y[idx]);
+    }
 
     t1 = cv::getTickCount();   
     cout<<"Time spent "<<(t1-t0)/cv::getTickFrequency()<<" Seconds"<<endl;  
+    cout<<"Peak RSS "<<peak_rss_mb()<<" MB"<<endl;
     
     //=================================================================== 
-    Mat dvx (  height*width*lf_ptr->nlabels, 1, CV_32F, depth_x);
-    Mat dvy (  height*width*lf_ptr->nlabels, 1, CV_32F, depth_y);          
+    //Mat dvx (  height*width*lf_ptr->nlabels, 1, CV_32F, depth_x);
+    //Mat dvy (  height*width*lf_ptr->nlabels, 1, CV_32F, depth_y);          
     //mat2hdf5("./debug/data/dvx.h5", "data", H5T_NATIVE_FLOAT, float(), dvx);                     
     //mat2hdf5("./debug/data/dvy.h5", "data", H5T_NATIVE_FLOAT, float(), dvy);    
-    Mat rrr = Mat(height, width, CV_8U, depth_best_xy);
+    //Mat rrr = Mat(height, width, DataType<LabelT>::type, depth_best_xy);
     //color_map_confidence(lf_ptr, rrr, "./debug/data/depth0.png", 0, confidence_x, confidence_y, 1); 
     //color_map_confidence(lf_ptr, rrr, "./debug/data/depth2.png", 2, confidence_x, confidence_y, 1);      
     //color_map_confidence(lf_ptr, rrr, "./debug/data/depth4.png", 4, confidence_x, confidence_y, 1);
     //color_map_confidence(lf_ptr, rrr, "./debug/data/depth6.png", 6, confidence_x, confidence_y, 1);
 
-    if (lf_ptr->type==1){ //Refine the depth result for Lytro data
-        lf2depth_mrf(depth_x, depth_y, confidence_x, confidence_y, lf_ptr);
+    if ((lf_ptr->type==1)&&(lf_ptr->pipeline==0)){ //Refine the depth result for Lytro data
+        if (merged){ //same input whether the volumes were built or loaded
+            dense_volume<float> vol(merged, num_labels, 1);
+            lf2depth_mrf(vol, vol, confidence_x, confidence_y, lf_ptr);
+        }
+        else if (banded)
+            lf2depth_mrf(band_x, band_y, confidence_x, confidence_y, lf_ptr);
+        else { //one volume of the chosen stacks, the other direction is not read
+            volume_select(depth_x, depth_y, confidence_x, confidence_y, lf_ptr);
+            pool_release_slot(lf_ptr, LF_POOL_COST_Y, depth_y);
+            depth_y = NULL;
+            dense_volume<T> vol(depth_x, num_labels, lf_ptr->q_cost);
+            lf2depth_mrf(vol, vol, confidence_x, confidence_y, lf_ptr);
+        }
     }
     else {//Just copy
-        Mat result = Mat(height, width, CV_8U, depth_best_xy);
+        Mat result = Mat(height, width, DataType<LabelT>::type, depth_best_xy);
         result.convertTo(lf_ptr->depth, CV_32F);
+        if (depth_sub)
+            add(lf_ptr->depth, Mat(height, width, CV_32F, depth_sub), lf_ptr->depth);
     }
+
+	pool_free(lf_ptr, depth_x);
+	pool_free(lf_ptr, depth_y);
+	pool_free(lf_ptr, depth_cx);
+	pool_free(lf_ptr, depth_cy);
+	pool_free(lf_ptr, merged);
+	pool_free(lf_ptr, confidence_x);
+	pool_free(lf_ptr, confidence_y);
+	free(depth_sub);
+	delete[] depth_best_xy;
+}
+
+/**
+    Estimate the disparity map with label maps of type LabelT, dispatching on the
+    cost volume element type.
+    @lf_ptr   the light field structure pointer
+*/
+template<typename LabelT>
+void lf2depth_labels(LF* lf_ptr){
+
+    int width  = lf_ptr->W;
+    int height = lf_ptr->H;
+
+    switch (lf_ptr->cost_type){
+        case 1:  lf2depth_estimate<uint16_t,  LabelT>(lf_ptr); break;
+        case 2:  lf2depth_estimate<cost_half, LabelT>(lf_ptr); break;
+        default: lf2depth_estimate<float,     LabelT>(lf_ptr);
+    }
+
+    //measure the quantization error (volumes or 8-bit cost) against the float path
+    bool quantized = (lf_ptr->cost_type!=0)||(lf_ptr->cost_engine==2);
+    if ((lf_ptr->verify==1)&&quantized&&(lf_ptr->pipeline==0)){
+        cout<<" ======== Verify against float volumes ======>>>>>>>"<<endl;
+        Mat depth_q = lf_ptr->depth.clone();
+        int engine  = lf_ptr->cost_engine;
+        if (engine==2)
+            lf_ptr->cost_engine = 0;
+        lf2depth_estimate<float, LabelT>(lf_ptr);
+        lf_ptr->cost_engine = engine;
+
+        float step = (lf_ptr->d_max-lf_ptr->d_min)/float(lf_ptr->nlabels);
+        Mat disp_q, disp_f;
+        depth_q.convertTo      (disp_q, CV_32F, step, lf_ptr->d_min);
+        lf_ptr->depth.convertTo(disp_f, CV_32F, step, lf_ptr->d_min);
+        error_comparison(disp_q, disp_f, Mat::ones(height, width, CV_32F), lf_ptr->erro_map_filename.c_str());
+        lf_ptr->depth = depth_q;
+    }
+}
+
+/**
+    Estimate and filter the depth (lf_ptr->depth, depth_f and confidence)
+    without writing any output file.
+    @lf_ptr   the light field structure pointer; without lf_ptr->ctx the run
+              uses a private context released on return
+*/
+void lf2depth_compute(LF* lf_ptr){
+
+    lf_context own;
+    bool private_ctx = (lf_ptr->ctx==NULL);
+    if (private_ctx){
+        lf_context_init(&own, 0);
+        own.private_run = 1;
+        lf_ptr->ctx = &own;
+    }
+    if (lf_ptr->ctx->threads>0) //per calling thread, concurrent runs keep their own
+        omp_set_num_threads(lf_ptr->ctx->threads);
+
+    if (lf_ptr->type==0){ //HCI
+        lf_ptr->d_min=lf_ptr->dt_min;
+        lf_ptr->d_max=lf_ptr->dt_max;
+    }
+    lf_init_params(lf_ptr); //already done by lf_init, not by every caller
+
+    //8-bit label maps up to 256 labels, 16-bit above
+    if (lf_ptr->nlabels<=256)
+        lf2depth_labels<uchar> (lf_ptr);
+    else
+        lf2depth_labels<ushort>(lf_ptr);
+
     depth_filtering(lf_ptr);//post filtering
+
+    if (private_ctx){
+        lf_context_release(&own);
+        lf_ptr->ctx = NULL;
+    }
+}
+
+/**
+    Extact the depth from horizontal and vertical EPI slices
+    @lf_ptr   the light field structure pointer; without lf_ptr->ctx the run
+              uses a private context released on return
+    @depth    the final result
+*/
+bool lf2depth(LF* lf_ptr){
+
+    int width  = lf_ptr->W;
+    int height = lf_ptr->H;
+
+    lf2depth_compute(lf_ptr);
+
+    if (lf_ptr->type==0){ //HCI: compare with the ground truth
+        float step = (lf_ptr->d_max-lf_ptr->d_min)/float(lf_ptr->nlabels);
+        Mat disp;
+        lf_ptr->depth_f.convertTo(disp, CV_32F, step, lf_ptr->d_min);
+        cout<<" ======== Ground truth ("<<lf_ptr->nlabels<<" labels, subpixel "<<lf_ptr->subpixel<<") ======>>>>>>>"<<endl;
+        error_comparison(disp, lf_ptr->disparity_gt, lf_ptr->disparity_mask, lf_ptr->erro_map_filename.c_str());
+    }
     color_map(lf_ptr->depth(Rect(20,20,width-40,height-40)),  lf_ptr->depth_filename.c_str(),       0);
     color_map(lf_ptr->depth_f(Rect(20,20,width-40,height-40)),lf_ptr->depth_filter_filename.c_str(),0);
     //grey_map (lf_ptr->depth_f(Rect(20,20,width-40,height-40))*4,"./debug/data/r.png",0);
- 
-	delete[] depth_x;
-	delete[] depth_y;
-	delete[] depth_cx;
-	delete[] depth_cy;	
-	delete[] confidence_x;
-	delete[] confidence_y;
-	delete[] depth_best_x;
-	delete[] depth_best_y;
-	delete[] depth_best_xy;
-    delete[] d;
 	 
 	return true;
 }
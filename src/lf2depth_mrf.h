@@ -9,45 +9,124 @@
 #include "volume_filtering.h"
 #include "light_field.h"
 #include "misc.h"
+#include "cost_types.h"
 using namespace std;
 using namespace cv;
 
 /**
-    Merge the vertical and horizontal volumes to a single volume.
-    @depth_x  the horizontal volume as input
-    @depth_y  the vertical   volume as input
-    @cost     the merged volume as output
+    Merge the vertical and horizontal volumes to a single volume: every pixel
+    keeps the stack of its more confident direction, decoded to float. The MRF
+    makes the same choice in place (mrf_data_cost); the merged copy is what the
+    cost cache stores.
+    @vol_x    the horizontal volume as input (dense_volume or band_volume)
+    @vol_y    the vertical   volume as input
+    @conf_x   the horizontal confidence map (before spatial filtering)
+    @conf_y   the vertical   confidence map
+    @cost     the merged volume as output, num_pixels*nlabels floats
     @lf_ptr   the light field structure pointer
 */
-void volume_merge(  float* depth_x, 
-                    float* depth_y,  
-					float* conf_x,
-					float* conf_y,              
-                    float* cost, 
+template<typename V>
+void volume_merge(  const V& vol_x,
+                    const V& vol_y,
+                    const float* conf_x,
+                    const float* conf_y,
+                    float* cost,
                     LF* lf_ptr){
-                   
-	for (int j = 1; j < (lf_ptr->H-1); j++)
-		for (int i = 1; i < (lf_ptr->W-1); i++){
-			int idx = j*lf_ptr->W +i;
-			if (conf_x[idx]>conf_y[idx])
-				memcpy(&cost[lf_ptr->nlabels*idx], &depth_x[lf_ptr->nlabels*idx], lf_ptr->nlabels*sizeof(float) );
-		    else   
-				memcpy(&cost[lf_ptr->nlabels*idx], &depth_y[lf_ptr->nlabels*idx], lf_ptr->nlabels*sizeof(float) );      
-		}                      
+
+	int num_pixels = lf_ptr->W*lf_ptr->H;
+	int num_labels = lf_ptr->nlabels;
+
+	#pragma omp parallel for
+	for (int idx = 0; idx < num_pixels; idx++){
+		const V& vol = (conf_x[idx]>conf_y[idx]) ? vol_x : vol_y;
+		for (int k = 0; k < num_labels; k++)
+			cost[(long)idx*num_labels+k] = vol.at(idx, k);
+	}
 }
 
+/**
+    Merge the vertical volume into the horizontal one in place: every pixel the
+    MRF reads from the vertical direction gets its stack copied into vol_x, so
+    the MRF runs on vol_x alone and vol_y can be freed before it.
+    @vol_x    the horizontal dense volume, the merged volume as output
+    @vol_y    the vertical   dense volume
+    @conf_x   the horizontal confidence map (as the MRF reads it)
+    @conf_y   the vertical   confidence map
+    @lf_ptr   the light field structure pointer
+*/
+template<typename T>
+void volume_select( T* vol_x,
+                    const T* vol_y,
+                    const float* conf_x,
+                    const float* conf_y,
+                    LF* lf_ptr){
+
+	int num_pixels = lf_ptr->W*lf_ptr->H;
+	int num_labels = lf_ptr->nlabels;
+
+	#pragma omp parallel for
+	for (int idx = 0; idx < num_pixels; idx++)
+		if (!(conf_x[idx]>conf_y[idx])) //the choice of lf2depth_mrf
+			memcpy(vol_x+(long)idx*num_labels, vol_y+(long)idx*num_labels, num_labels*sizeof(T));
+}
+
+/**
+    Smoothness cost between two neighbouring labels (l1 norm). A function instead
+    of a num_labels^2 table so large label counts stay cheap.
+*/
+GCoptimization::EnergyTermType smooth_l1(GCoptimization::SiteID s1, GCoptimization::SiteID s2,
+                                         GCoptimization::LabelID l1, GCoptimization::LabelID l2){
+    return abs(l1 - l2);
+}
+
+/**
+    Lazy data cost: lambda times the cost of the volume chosen for the site,
+    read in place from the cost volumes when GCO asks for it, so no table of
+    nlabels costs per pixel is built.
+*/
+template<typename V>
+struct mrf_data_cost : GCoptimization::DataCostFunctor{
+
+    const V* vol_x;
+    const V* vol_y;
+    const unsigned char* site; //0: no data cost, 1: vol_x, 2: vol_y
+    float lambda;
+
+    mrf_data_cost(const V* vol_x, const V* vol_y, const unsigned char* site, float lambda)
+        : vol_x(vol_x), vol_y(vol_y), site(site), lambda(lambda) {}
+
+    GCoptimization::EnergyTermType compute(GCoptimization::SiteID s, GCoptimization::LabelID l){
+        if (site[s]==1) return (GCoptimization::EnergyTermType)(lambda*vol_x->at(s, l));
+        if (site[s]==2) return (GCoptimization::EnergyTermType)(lambda*vol_y->at(s, l));
+        return 0;
+    }
+};
+
 /**
     Using Makov Random Field (Multi-label optimization) to refine the disparity map.
-    @depth_x  the horizontal volume as input
-    @depth_y  the vertical   volume as input
+    The data cost of a pixel comes from the volume of the more confident direction.
+    The pixel grid is a GCO grid graph with per-edge weights (MRF_GRAPH 1) or a
+    general graph built edge by edge (MRF_GRAPH 0). The data costs are a table
+    (MRF_DATACOST 0), read lazily from the volumes (MRF_DATACOST 1) or a table of
+    the sites that carry a cost, the others being free (MRF_DATACOST 2). With
+    MRF_POOL 1 the graph of the moves is allocated once and reset between them.
+    With MRF_DYNAMIC the moves run on dynamic graphs of the context that keep
+    their search trees for the next move and the next frame: one graph (1) or
+    one graph per label (2), where a move is solved again on the graph of the
+    same label in the previous frame. The latter pays off on sequences of
+    similar frames and holds nlabels graphs of the size of the image. Grid
+    graph only: it keeps the dropped edges with weight 0, so its structure is
+    the same from frame to frame, which the general graph's is not.
+    @vol_x    the horizontal volume as input (dense_volume or band_volume)
+    @vol_y    the vertical   volume as input
     @confidence_x   the horizontal confidence map
     @confidence_y   the vertical   confidence map 
     @depth_best_xy  the first estimate disparity map   
     @lf_ptr   the light field structure pointer
 */
-
-bool lf2depth_mrf(  float *depth_x,
-                    float *depth_y,
+template<typename V>
+bool lf2depth_mrf(  const V& vol_x,
+                    const V& vol_y,
                     float *confidence_x,
                     float *confidence_y,              
                     LF* lf_ptr){
@@ -56,71 +135,168 @@ bool lf2depth_mrf(  float *depth_x,
     int height = lf_ptr->H;
     int num_pixels = width*height;
     int num_labels = lf_ptr->nlabels;
-    float *cost         = new float[num_pixels*num_labels];
 
     cout<<" ======== MRF Refinement Result ======>>>>>>>"<<endl;
-    volume_merge(depth_x, depth_y, confidence_x, confidence_y, cost, lf_ptr);
          
-    int *smooth = new int[num_labels*num_labels];
-	    for (int l1 = 0; l1 < num_labels; l1++)
-		    for (int l2 = 0; l2 < num_labels; l2++)
-			    smooth[l1 + l2*num_labels] = abs(l1 - l2);//abs(l1 - l2);//*(l1 - l2);//abs(l1 - l2);//l1 norm
-
     try{
 
-	    GCoptimizationGeneralGraph *gc = new GCoptimizationGeneralGraph(num_pixels, num_labels);
-
+        int64 t0 = cv::getTickCount();
         if (lf_ptr->lambda==0) lf_ptr->lambda=1;
-	    //add data costs individually
+	    //volume of the data cost of each site: none on the border and where
+	    //neither direction is reliable, else the more confident direction
+	    vector<unsigned char> site(num_pixels);
+	    #pragma omp parallel for
 	    for (int j = 0; j<height; j++)
 		    for (int i = 0; i<width; i++){
-
 		        int idx = j*width+i;
-		        for (int k = 0; k<num_labels; k++){
-		        
-		        	if ((j>4)&&(i>4)&&(j<(width-4))&&(i<(height-4))){
-		               		            
-       					if ((confidence_x[idx]<lf_ptr->threshold)&&(confidence_y[idx]<lf_ptr->threshold))
-		                    gc->setDataCost(idx, k, 0);				            
-		                else
-		                    gc->setDataCost(idx, k, (lf_ptr->lambda*cost[num_labels*idx+k])); 			 
-			        }
-			        else 
-			            gc->setDataCost(idx, k, 0); 
-			    }
+		        if ((j>4)&&(i>4)&&(j<(width-4))&&(i<(height-4))&&
+		            !((confidence_x[idx]<lf_ptr->threshold)&&(confidence_y[idx]<lf_ptr->threshold)))
+		            site[idx] = (confidence_x[idx]>confidence_y[idx]) ? 1 : 2;
+		        else
+		            site[idx] = 0;
 		    }
+	    mrf_data_cost<V> lazy(&vol_x, &vol_y, &site[0], lf_ptr->lambda);
+
+	    //data costs in one table of the context pool, kept warm between runs;
+	    //GCO reads the table in place (setDataCost(array) does not copy it).
+	    //Free sites: rows only for the sites with a cost, row[idx] -1 for the others
+	    GCoptimization::EnergyTermType* data = NULL;
+	    vector<GCoptimization::SiteID> row;
+	    int rows = num_pixels;
+	    if (lf_ptr->mrf_datacost==2){
+	        row.resize(num_pixels);
+	        rows = 0;
+	        for (int idx = 0; idx<num_pixels; idx++)
+	            row[idx] = site[idx] ? rows++ : -1;
+	        cout<<" MRF sites with a data cost: "<<rows<<" of "<<num_pixels<<endl;
+	    }
+	    if ((lf_ptr->mrf_datacost==0)||(lf_ptr->mrf_datacost==2)){
+	        data = (GCoptimization::EnergyTermType*)
+	            pool_alloc(lf_ptr, LF_POOL_MRF_DATA, size_t(max(rows, 1))*num_labels*sizeof(GCoptimization::EnergyTermType), false);
+	        #pragma omp parallel for
+	        for (int idx = 0; idx<num_pixels; idx++){
+	            int r = row.empty() ? idx : row[idx];
+	            if (r<0)
+	                continue;
+	            GCoptimization::EnergyTermType* cost = data + size_t(r)*num_labels;
+	            for (int k = 0; k<num_labels; k++)
+	                cost[k] = lazy.compute(idx, k);
+	        }
+	    }
+
+	    //dynamic graphs, kept in the context for the next frame; the general graph
+	    //drops its edges by confidence, so its structure changes every frame
+	    int dynamic = lf_ptr->mrf_dynamic;
+	    if (dynamic&&(lf_ptr->mrf_graph!=1)){
+	        cout<<" MRF: MRF_DYNAMIC needs the grid graph (MRF_GRAPH 1), disabled"<<endl;
+	        dynamic = 0;
+	    }
+	    GCoptimization::DynamicGraph* graphs = NULL;
+	    GCoptimization::DynamicGraph* own    = NULL;
+	    int ngraphs = (dynamic==2) ? num_labels : 1;
+	    if (dynamic&&lf_ptr->ctx){
+	        lf_context* ctx = lf_ptr->ctx;
+	        if (ctx->nmrf_graphs!=ngraphs){
+	            delete[] ctx->mrf_graphs;
+	            ctx->mrf_graphs  = new GCoptimization::DynamicGraph[ngraphs];
+	            ctx->nmrf_graphs = ngraphs;
+	        }
+	        graphs = ctx->mrf_graphs;
+	    }
+	    else if (dynamic)
+	        graphs = own = new GCoptimization::DynamicGraph[ngraphs];
+
+	    //grid neighborhood system: an edge is kept where the confidence of its
+	    //second site is below the threshold
+	    GCoptimization* gc;
+	    if (lf_ptr->mrf_graph==1){
 
-		    // now set up a grid neighborhood system
+	        //edge weights, hw[p] for (p,p+1) and vw[p] for (p,p+width); 0 drops the edge,
+	        //except for dynamic graphs whose edges must stay the same from frame to frame
+	        vector<GCoptimization::EnergyTermType> hw(num_pixels, 0), vw(num_pixels, 0);
+	        #pragma omp parallel for
+	        for (int y = 1; y < height; y++ )
+		        for (int  x = 1; x < width; x++ ){
+			        int p2 = x+y*width;
+			        hw[p2-1]     = confidence_x[p2]<lf_ptr->threshold;
+			        vw[p2-width] = confidence_y[p2]<lf_ptr->threshold;
+		        }
+	        GCoptimizationGridGraph* grid = new GCoptimizationGridGraph(width, height, num_labels);
+	        grid->setNeighborWeights(&vw[0], &hw[0], !graphs);
+	        gc = grid;
+	    }
+	    else {
+
+	        GCoptimizationGeneralGraph* general = new GCoptimizationGeneralGraph(num_pixels, num_labels);
 		    // first set up horizontal neighbors
 		    for (int y = 1; y < height; y++ )
 			    for (int  x = 1; x < width; x++ ){
 				    int p1  = x-1+y*width;
 				    int p2  = x+  y*width;			
 				    int p3  = x+(y-1)*width;										
-				    //int  weightx = confidence_x[p2]>lf_ptr->threshold ? 0: 1;	
-				    //int  weighty = confidence_y[p2]>lf_ptr->threshold ? 0: 1;						    
-				    if (confidence_x[p2]<lf_ptr->threshold) gc->setNeighbors(p1,p2);
-				    if (confidence_y[p2]<lf_ptr->threshold) gc->setNeighbors(p3,p2);		
+				    if (confidence_x[p2]<lf_ptr->threshold) general->setNeighbors(p1,p2);
+				    if (confidence_y[p2]<lf_ptr->threshold) general->setNeighbors(p3,p2);		
 			    }
-
-	    gc->setSmoothCost(smooth);
+	        gc = general;
+	    }
+	    if (!row.empty())
+	        gc->setDataCostRows(data, &row[0]);
+	    else if (data)
+	        gc->setDataCost(data);
+	    else
+	        gc->setDataCostFunctor(&lazy);
+	    gc->setSmoothCost(smooth_l1);
+	    gc->setPoolMode((lf_ptr->mrf_pool==1)&&!graphs);
+	    gc->setDynamicGraph(graphs, ngraphs);
         gc->setVerbosity(1);
-	    printf("Before optimization energy is %lld\n", gc->compute_energy());
+	    cout<<" MRF setup Done "<<(cv::getTickCount()-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+	    printf("Before optimization energy is %lld\n", (long long)gc->compute_energy());
+
+	    int moves = 0, reused = 0;
+	    for (int n = 0; graphs&&(n<ngraphs); n++){
+	        moves  -= graphs[n].moves;
+	        reused -= graphs[n].reused;
+	    }
+	    t0 = cv::getTickCount();
 	    gc->expansion(1);
-        printf("After optimization energy is %lld\n", gc->compute_energy());
+	    cout<<" MRF expansion Done "<<(cv::getTickCount()-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+	    for (int n = 0; graphs&&(n<ngraphs); n++){
+	        moves  += graphs[n].moves;
+	        reused += graphs[n].reused;
+	    }
+	    if (graphs)
+	        cout<<" MRF moves reusing the search trees: "<<reused<<" of "<<moves<<endl;
+        printf("After optimization energy is %lld\n", (long long)gc->compute_energy());
 	    for (int j = 0; j<height; j++)
 		    for (int i = 0; i<width; i++)
 			    lf_ptr->depth.at<float>(j,i) = gc->whatLabel(j*width+i);
+
+	    //sub-label refinement of the pixels that carry a data cost; skipped where
+	    //a neighbouring label lies outside the band of a banded volume, whose
+	    //coarse cost would bias the parabola
+	    if (lf_ptr->subpixel)
+	        for (int j = 5; j<(height-4); j++)
+		        for (int i = 5; i<(width-4); i++){
+		            int idx = j*width+i;
+		            int k   = gc->whatLabel(idx);
+		            if ((k==0)||(k==(num_labels-1))||
+		                ((confidence_x[idx]<lf_ptr->threshold)&&(confidence_y[idx]<lf_ptr->threshold)))
+		                continue;
+		            const V& vol = (confidence_x[idx]>confidence_y[idx]) ? vol_x : vol_y;
+		            if (!vol.exact(idx, k-1)||!vol.exact(idx, k+1))
+		                continue;
+		            lf_ptr->depth.at<float>(j,i) += subpixel_offset(vol.at(idx, k-1), vol.at(idx, k), vol.at(idx, k+1), lf_ptr->subpixel);
+		        }
       
 	    delete gc;
+	    delete[] own;
+	    pool_free(lf_ptr, data);
     }
 
     catch (GCException e){
 	    e.Report();
     }
         
-    delete[] cost;
-	delete[] smooth;	
 	return true;
 }
 
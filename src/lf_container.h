@@ -0,0 +1,215 @@
+//  Native light field container (.lfr): the 8-bit tensor blocks stored in the pipeline's own
+//  layout, memory mapped at load time so ingest needs no image decode and no transpose.
+
+#ifndef _LF_CONTAINER
+#define _LF_CONTAINER
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "light_field.h"
+
+using namespace std;
+using namespace cv;
+
+#define LFR_MAGIC   "LFR1"
+#define LFR_ALIGN   4096   //blocks start on a page so they map directly
+
+/**
+    File header. The blocks follow at the given byte offsets:
+        row    lf_tensor::row8, (U*H+2) x W x 3 bytes
+        col    lf_tensor::col8, (V*W+2) x H x 3 bytes
+        gt     central view disparity, H x W floats (has_gt)
+        mask   central view evaluation mask, H x W floats (has_gt)
+*/
+typedef struct {
+
+    char     magic[4];
+    int32_t  W;
+    int32_t  H;
+    int32_t  U;
+    int32_t  V;
+    int32_t  vflip;
+    int32_t  has_gt;
+    float    dt_min;
+    float    dt_max;
+    int32_t  reserved;
+    uint64_t row_offset;
+    uint64_t col_offset;
+    uint64_t gt_offset;
+    uint64_t mask_offset;
+
+}lfr_header;
+
+/**
+    True if the data file is a .lfr container.
+    @filename    data file name (DATA_H5)
+*/
+bool lfr_is_container(const string& filename){
+
+    return (filename.size()>4)&&(filename.compare(filename.size()-4, 4, ".lfr")==0);
+}
+
+/**
+    True if a block of the file lies inside it, without overflow on corrupt offsets.
+    @offset      byte offset of the block
+    @bytes       size of the block
+    @size        size of the file
+*/
+inline bool lfr_block_in(uint64_t offset, uint64_t bytes, uint64_t size){
+
+    return (offset<=size)&&(bytes<=size-offset);
+}
+
+/**
+    Write the 8-bit tensor blocks (and the HCI ground truth) of a loaded light field.
+    @filename    output .lfr file
+    @lf_ptr      light field structure pointer, with lf_ptr->lf.row8 and col8 filled
+    @return      false if the file cannot be written
+*/
+bool lfr_write(const char* filename, LF* lf_ptr){
+
+    const lf_tensor& t = lf_ptr->lf;
+    if (t.row8.empty()||t.col8.empty()){
+        cout<<" LFR: the 8-bit tensor blocks are missing"<<endl;
+        return false;
+    }
+
+    size_t row_bytes = t.row8.total()*3;
+    size_t col_bytes = t.col8.total()*3;
+    size_t map_bytes = size_t(t.W)*t.H*sizeof(float);
+
+    lfr_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LFR_MAGIC, 4);
+    h.W = t.W;  h.H = t.H;  h.U = t.U;  h.V = t.V;
+    h.vflip  = t.vflip;
+    h.has_gt = (lf_ptr->type==0);
+    h.dt_min = lf_ptr->dt_min;
+    h.dt_max = lf_ptr->dt_max;
+    h.row_offset  = LFR_ALIGN;
+    h.col_offset  = (h.row_offset + row_bytes + LFR_ALIGN-1)/LFR_ALIGN*LFR_ALIGN;
+    h.gt_offset   = (h.col_offset + col_bytes + LFR_ALIGN-1)/LFR_ALIGN*LFR_ALIGN;
+    h.mask_offset = h.gt_offset + map_bytes;
+
+    FILE* f = fopen(filename, "wb");
+    if (!f){
+        cout<<" LFR: cannot write "<<filename<<endl;
+        return false;
+    }
+    bool ok = (fwrite(&h, sizeof(h), 1, f)==1);
+
+    fseek(f, h.row_offset, SEEK_SET);
+    for (int j=0; ok&&(j<t.row8.rows); j++)
+        ok = (fwrite(t.row8.ptr(j), t.row8.cols*3, 1, f)==1);
+    fseek(f, h.col_offset, SEEK_SET);
+    for (int j=0; ok&&(j<t.col8.rows); j++)
+        ok = (fwrite(t.col8.ptr(j), t.col8.cols*3, 1, f)==1);
+
+    if (h.has_gt){
+        fseek(f, h.gt_offset, SEEK_SET);
+        for (int j=0; ok&&(j<t.H); j++)
+            ok = (fwrite(lf_ptr->disparity_gt.ptr(j),   t.W*sizeof(float), 1, f)==1);
+        for (int j=0; ok&&(j<t.H); j++)
+            ok = (fwrite(lf_ptr->disparity_mask.ptr(j), t.W*sizeof(float), 1, f)==1);
+    }
+    ok = (fclose(f)==0)&&ok;
+
+    cout<<" LFR: wrote "<<filename<<" ("<<(ok ? "ok" : "failed")<<")"<<endl;
+    return ok;
+}
+
+/**
+    Load a .lfr container in place of the multiview image and mview2tensor:
+    the 8-bit blocks are views of a read-only mapping of the file, the float
+    blocks are only widened from them when a kernel reads them, and the
+    central view and the ground truth are copied out.
+    @lf_ptr      light field structure pointer (data_filename, W, H, U, V set)
+    @return      false if the file is missing, truncated or does not match the configuration
+*/
+bool lfr_load(LF* lf_ptr){
+
+    int64 t0 = cv::getTickCount();
+    lf_tensor& t = lf_ptr->lf;
+    t.map = NULL;
+    t.map_bytes = 0;
+
+    int fd = open(lf_ptr->data_filename.c_str(), O_RDONLY);
+    struct stat st;
+    if ((fd<0)||(fstat(fd, &st)!=0)||(size_t(st.st_size)<sizeof(lfr_header))){
+        cout<<" LFR: cannot open "<<lf_ptr->data_filename<<endl;
+        if (fd>=0) close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map==MAP_FAILED){
+        cout<<" LFR: cannot map "<<lf_ptr->data_filename<<endl;
+        return false;
+    }
+
+    const unsigned char* base = (const unsigned char*) map;
+    lfr_header h;
+    memcpy(&h, base, sizeof(h));
+    int W = lf_ptr->W;
+    int H = lf_ptr->H;
+    int U = lf_ptr->U;
+    int V = lf_ptr->V;
+    if ((memcmp(h.magic, LFR_MAGIC, 4)!=0)||(h.W!=W)||(h.H!=H)||(h.U!=U)||(h.V!=V)){
+        cout<<" LFR: "<<lf_ptr->data_filename<<" does not match the configuration ("
+            <<h.W<<"x"<<h.H<<", "<<h.U<<"x"<<h.V<<" views)"<<endl;
+        munmap(map, st.st_size);
+        return false;
+    }
+    uint64_t size      = st.st_size;
+    uint64_t map_bytes = uint64_t(W)*H*sizeof(float);
+    if ((!lfr_block_in(h.row_offset, uint64_t(U*H+2)*W*3, size))||
+        (!lfr_block_in(h.col_offset, uint64_t(V*W+2)*H*3, size))||
+        (h.has_gt&&((!lfr_block_in(h.gt_offset, map_bytes, size))||(!lfr_block_in(h.mask_offset, map_bytes, size))))){
+        cout<<" LFR: "<<lf_ptr->data_filename<<" is truncated or has a block outside the file"<<endl;
+        munmap(map, st.st_size);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    t.vflip = h.vflip;
+    t.map   = map;
+    t.map_bytes = st.st_size;
+    tensor_attach(lf_ptr, (unsigned char*)(base + h.row_offset), (unsigned char*)(base + h.col_offset));
+
+    if (h.has_gt){
+        lf_ptr->disparity_gt = Mat(H, W, CV_32F);
+        memcpy(lf_ptr->disparity_gt.ptr(0), base + h.gt_offset, size_t(W)*H*sizeof(float));
+        if (lf_ptr->mask==1)
+            memcpy(lf_ptr->disparity_mask.ptr(0), base + h.mask_offset, size_t(W)*H*sizeof(float));
+        lf_ptr->dt_min = h.dt_min;
+        lf_ptr->dt_max = h.dt_max;
+    }
+
+    cout<<" Loading LFR Done "<<(cv::getTickCount()-t0)/cv::getTickFrequency()<<" Seconds"<<endl;
+    return true;
+}
+
+/**
+    Release the file mapping of a .lfr input.
+    @lf_ptr      light field structure pointer
+*/
+void lfr_close(LF* lf_ptr){
+
+    lf_tensor& t = lf_ptr->lf;
+    if (!t.map)
+        return;
+    t.row8.release();
+    t.col8.release();
+    munmap(t.map, t.map_bytes);
+    t.map = NULL;
+}
+
+#endif
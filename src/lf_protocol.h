@@ -0,0 +1,84 @@
+//  Wire format of the depth service (lf2depth --serve) on a local Unix-domain socket.
+//  Shared by the service and by the tools, so it only depends on the C library.
+
+#ifndef _LF_PROTOCOL
+#define _LF_PROTOCOL
+
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define LF_REQUEST_MAGIC   "LFQ1"
+#define LF_RESPONSE_MAGIC  "LFA1"
+
+/**
+    Request: the header, followed by the mosaic unless it is named by shm.
+    The mosaic is the Lytro multiview image, (H*V) x (W*U) BGR bytes, row major.
+    Geometry fields of 0 and parameter fields below 0 keep the service
+    configuration; d_min>=d_max keeps the configured disparity range.
+*/
+typedef struct {
+
+    char     magic[4];
+    int32_t  W, H, U, V;     //view size and number of views
+    int32_t  nlabels;
+    int32_t  window;
+    int32_t  cost_engine;
+    int32_t  color_mode;
+    int32_t  subpixel;
+    int32_t  threshold;
+    float    lambda;
+    float    d_min, d_max;
+    char     shm[64];        //POSIX shared memory object holding the mosaic, "" if it follows
+    uint64_t bytes;          //mosaic size
+
+}lf_request;
+
+/**
+    Response: the header, then on success the disparity and the confidence
+    maps of the central view, H x W floats each.
+*/
+typedef struct {
+
+    char     magic[4];
+    int32_t  status;         //0 ok, 1 bad request, 2 no input
+    int32_t  W, H;
+    float    seconds;        //time spent in the service
+
+}lf_response;
+
+/**
+    Read exactly n bytes from a socket.
+    @return      false on error or end of stream
+*/
+bool lf_read_full(int fd, void* buf, size_t n){
+
+    char* p = (char*) buf;
+    while (n>0){
+        ssize_t r = read(fd, p, n);
+        if ((r<0)&&(errno==EINTR)) continue;
+        if (r<=0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+/**
+    Write exactly n bytes to a socket.
+    @return      false on error
+*/
+bool lf_write_full(int fd, const void* buf, size_t n){
+
+    const char* p = (const char*) buf;
+    while (n>0){
+        ssize_t r = write(fd, p, n);
+        if ((r<0)&&(errno==EINTR)) continue;
+        if (r<=0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,204 @@
+//  Shared-memory frame ring between a capture process and lf2depth --ring. A slot holds the
+//  8-bit light field tensor blocks of one frame in the pipeline's own layout (as in .lfr),
+//  so the consumer runs on the slot in place, plus the disparity and confidence it returns.
+//  Shared by lf2depth and by the tools, so it only depends on the C library.
+
+#ifndef _LF_RING
+#define _LF_RING
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LF_RING_MAGIC   "LFS1"
+#define LF_RING_ALIGN   4096
+
+/**
+    Ring header, at the start of the shared memory object. Slot k starts at
+    slot_offset + k*slot_bytes and holds, at the given offsets:
+        lf_ring_slot   frame bookkeeping
+        row            central row of views,    (U*H+2) x W x 3 bytes
+        col            central column of views, (V*W+2) x H x 3 bytes, transposed
+        disp           disparity of the central view as output, H x W floats
+        conf           confidence of the central view as output, H x W floats
+    The producer takes a slot from free, fills it and posts filled; lf2depth
+    takes it from filled, writes the outputs and posts free. Slots are used
+    in order, so the outputs of a frame are read back by the producer when
+    it takes the same slot again (or when it drains the ring).
+*/
+typedef struct {
+
+    char     magic[4];
+    int32_t  W, H, U, V;
+    int32_t  slots;
+    uint64_t slot_offset;
+    uint64_t slot_bytes;
+    uint64_t row_offset, col_offset, disp_offset, conf_offset;
+    sem_t    filled;        //frames ready for lf2depth
+    sem_t    free;          //slots the producer may fill
+    uint64_t written;       //frames published
+    int32_t  closed;        //set by the producer once the last frame is published
+
+}lf_ring_header;
+
+/**
+    Bookkeeping of the frame held by a slot.
+*/
+typedef struct {
+
+    uint64_t frame;
+    int64_t  submit_ns;     //CLOCK_MONOTONIC when published
+    int64_t  done_ns;       //CLOCK_MONOTONIC when the outputs were written
+    int32_t  status;        //0 ok
+    float    seconds;       //time spent in lf2depth
+
+}lf_ring_slot;
+
+/**
+    CLOCK_MONOTONIC in nanoseconds, comparable between the two processes.
+*/
+int64_t lf_ring_now_ns(){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+}
+
+/**
+    Size of the whole shared memory object.
+*/
+uint64_t lf_ring_bytes(const lf_ring_header* h){
+
+    return h->slot_offset + uint64_t(h->slots)*h->slot_bytes;
+}
+
+/**
+    Start of slot k.
+*/
+unsigned char* lf_ring_slot_ptr(lf_ring_header* h, int k){
+
+    return (unsigned char*) h + h->slot_offset + uint64_t(k)*h->slot_bytes;
+}
+
+/**
+    Create the ring (producer side), replacing an object of the same name.
+    @name        POSIX shared memory object name, e.g. "/lf2depth_ring"
+    @W H U V     view size and number of views
+    @slots       number of frames in flight
+    @return      the mapped ring, NULL on failure
+*/
+lf_ring_header* lf_ring_create(const char* name, int W, int H, int U, int V, int slots){
+
+    lf_ring_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LF_RING_MAGIC, 4);
+    h.W = W;  h.H = H;  h.U = U;  h.V = V;
+    h.slots = slots;
+    h.slot_offset = (sizeof(lf_ring_header) + LF_RING_ALIGN-1)/LF_RING_ALIGN*LF_RING_ALIGN;
+    h.row_offset  = LF_RING_ALIGN;
+    h.col_offset  = (h.row_offset + uint64_t(U*H+2)*W*3 + LF_RING_ALIGN-1)/LF_RING_ALIGN*LF_RING_ALIGN;
+    h.disp_offset = (h.col_offset + uint64_t(V*W+2)*H*3 + LF_RING_ALIGN-1)/LF_RING_ALIGN*LF_RING_ALIGN;
+    h.conf_offset =  h.disp_offset + uint64_t(W)*H*sizeof(float);
+    h.slot_bytes  = (h.conf_offset + uint64_t(W)*H*sizeof(float) + LF_RING_ALIGN-1)/LF_RING_ALIGN*LF_RING_ALIGN;
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT|O_RDWR, 0600);
+    if ((fd<0)||(ftruncate(fd, lf_ring_bytes(&h))!=0)){
+        if (fd>=0) close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, lf_ring_bytes(&h), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map==MAP_FAILED)
+        return NULL;
+
+    lf_ring_header* r = (lf_ring_header*) map;
+    memcpy(r, &h, sizeof(h));
+    sem_init(&r->filled, 1, 0);
+    sem_init(&r->free,   1, slots);
+    return r;
+}
+
+/**
+    Attach to a ring created by the producer (lf2depth side).
+    @name        POSIX shared memory object name
+    @return      the mapped ring, NULL if it does not exist or is not a ring
+*/
+lf_ring_header* lf_ring_attach(const char* name){
+
+    int fd = shm_open(name, O_RDWR, 0);
+    struct stat st;
+    if ((fd<0)||(fstat(fd, &st)!=0)||(uint64_t(st.st_size)<sizeof(lf_ring_header))){
+        if (fd>=0) close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map==MAP_FAILED)
+        return NULL;
+
+    lf_ring_header* r = (lf_ring_header*) map;
+    if ((memcmp(r->magic, LF_RING_MAGIC, 4)!=0)||(lf_ring_bytes(r)>uint64_t(st.st_size))){
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+    Unmap a ring.
+*/
+void lf_ring_detach(lf_ring_header* h){
+
+    munmap(h, lf_ring_bytes(h));
+}
+
+/**
+    Store one decoded sub-aperture view into a slot. Only the views of the
+    central row and column are kept, the others are not read by the pipeline.
+    @h           ring
+    @slot        slot start (lf_ring_slot_ptr)
+    @u v         horizontal and vertical view index
+    @view        H x W BGR bytes, row major
+*/
+void lf_ring_put_view(const lf_ring_header* h, unsigned char* slot, int u, int v, const unsigned char* view){
+
+    int W = h->W, H = h->H;
+    if (v==(h->V-1)/2) //rows 1+u*H... of the row block
+        memcpy(slot + h->row_offset + (uint64_t(1+u*H))*W*3, view, size_t(W)*H*3);
+    if (u==(h->U-1)/2){ //transposed into rows 1+v*W... of the column block
+        unsigned char* col = slot + h->col_offset;
+        for (int j=0; j<H; j++)
+            for (int i=0; i<W; i++)
+                memcpy(col + ((uint64_t(1+v*W+i))*H + j)*3, view + (size_t(j)*W + i)*3, 3);
+    }
+}
+
+/**
+    Publish a filled slot (producer side).
+*/
+void lf_ring_publish(lf_ring_header* h, unsigned char* slot, uint64_t frame){
+
+    lf_ring_slot* s = (lf_ring_slot*) slot;
+    s->frame     = frame;
+    s->status    = -1;
+    s->submit_ns = lf_ring_now_ns();
+    __atomic_store_n(&h->written, frame+1, __ATOMIC_RELEASE);
+    sem_post(&h->filled);
+}
+
+/**
+    Tell lf2depth that no frame follows the published ones (producer side).
+*/
+void lf_ring_close(lf_ring_header* h){
+
+    __atomic_store_n(&h->closed, 1, __ATOMIC_RELEASE);
+    sem_post(&h->filled);
+}
+
+#endif
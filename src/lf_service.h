@@ -0,0 +1,302 @@
+//  Resident depth service: answers depth requests on a Unix-domain socket (lf2depth --serve)
+//  or frames of a shared-memory ring (lf2depth --ring), with the context, the light field
+//  tensor and the receive buffer kept warm between them.
+
+#ifndef _LF_SERVICE
+#define _LF_SERVICE
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <new>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lf_protocol.h"
+#include "lf_ring.h"
+#include "light_field.h"
+#include "config.h"
+#include "lf2depth.h"
+
+using namespace std;
+using namespace cv;
+
+#define LF_SERVICE_MAX_SIDE    16384            //largest view width or height of a request
+#define LF_SERVICE_MAX_VIEWS   32               //largest number of views per direction
+#define LF_SERVICE_MAX_MOSAIC  (uint64_t(1)<<30) //largest mosaic of a request, bytes
+#define LF_SERVICE_MAX_VOLUME  (uint64_t(1)<<30) //largest cost volume of a request, W*H*nlabels
+
+/**
+    Settings every scene of the service shares: the input is read as Lytro
+    data (view layout and MRF refinement) and nothing is written to disk.
+    @lf_ptr      light field structure pointer
+*/
+void lf_service_scene(LF* lf_ptr){
+
+    lf_ptr->type      = 1;
+    lf_ptr->mask      = 0;
+    lf_ptr->verify    = 0;
+    lf_ptr->cache_dir = "";
+    lf_ptr->centre_view_filename = "";
+}
+
+/**
+    Scene of a request: the service configuration with the overrides of the
+    request header (lf_service_scene). The geometry is bounded before anything
+    is allocated for it (LF_SERVICE_MAX_*), which also keeps the int sizes of
+    the pipeline from overflowing.
+    @q           request header
+    @base        service configuration
+    @lf_ptr      light field structure pointer as output
+    @return      false if the header is inconsistent or the scene too large
+*/
+bool lf_request_scene(const lf_request& q, const LF& base, LF* lf_ptr){
+
+    *lf_ptr = base;
+    if (q.W>0) lf_ptr->W = q.W;
+    if (q.H>0) lf_ptr->H = q.H;
+    if (q.U>0) lf_ptr->U = q.U;
+    if (q.V>0) lf_ptr->V = q.V;
+    if (q.nlabels>=0)     lf_ptr->nlabels     = q.nlabels;
+    if (q.window>=0)      lf_ptr->window      = q.window;
+    if (q.cost_engine>=0) lf_ptr->cost_engine = q.cost_engine;
+    if (q.color_mode>=0)  lf_ptr->color_mode  = q.color_mode;
+    if (q.subpixel>=0)    lf_ptr->subpixel    = q.subpixel;
+    if (q.threshold>=0)   lf_ptr->threshold   = q.threshold;
+    if (q.lambda>=0)      lf_ptr->lambda      = q.lambda;
+    if (q.d_min<q.d_max){
+        lf_ptr->d_min = q.d_min;
+        lf_ptr->d_max = q.d_max;
+    }
+    lf_service_scene(lf_ptr);
+    lf_init_params(lf_ptr);
+
+    int W = lf_ptr->W, H = lf_ptr->H, U = lf_ptr->U, V = lf_ptr->V;
+    if ((W<=40)||(H<=40)||(U<=0)||(V<=0)||(W>LF_SERVICE_MAX_SIDE)||(H>LF_SERVICE_MAX_SIDE)||
+        (U>LF_SERVICE_MAX_VIEWS)||(V>LF_SERVICE_MAX_VIEWS))
+        return false;
+    uint64_t expected = uint64_t(W)*H*U*V*3;
+    uint64_t volume   = uint64_t(W)*H*lf_ptr->nlabels;
+    return (expected<=LF_SERVICE_MAX_MOSAIC)&&(volume<=LF_SERVICE_MAX_VOLUME)&&(q.bytes==expected);
+}
+
+/**
+    Answer one request of a connection.
+    @fd          connected socket
+    @base        service configuration
+    @ctx         context of the service
+    @warm        light field tensor of the previous request, reused when the size matches
+    @buf         receive buffer of the mosaic, grows to the largest request
+    @return      false when the connection is closed or unusable
+*/
+bool lf_serve_request(int fd, const LF& base, lf_context* ctx, lf_tensor& warm, vector<uchar>& buf){
+
+    lf_request q;
+    if (!lf_read_full(fd, &q, sizeof(q)))
+        return false;
+
+    int64 t0 = cv::getTickCount();
+    lf_response a;
+    memset(&a, 0, sizeof(a));
+    memcpy(a.magic, LF_RESPONSE_MAGIC, 4);
+
+    LF lf;
+    q.shm[sizeof(q.shm)-1] = 0;
+    if ((memcmp(q.magic, LF_REQUEST_MAGIC, 4)!=0)||!lf_request_scene(q, base, &lf)){
+        cout<<" Service: bad request"<<endl;
+        a.status = 1;
+        lf_write_full(fd, &a, sizeof(a));
+        return false; //the stream cannot be resynchronised
+    }
+
+    //mosaic: in place from shared memory, or into the receive buffer
+    uchar* mosaic = NULL;
+    void*  map    = NULL;
+    if (q.shm[0]){
+        int sfd = shm_open(q.shm, O_RDONLY, 0);
+        struct stat st;
+        if ((sfd>=0)&&(fstat(sfd, &st)==0)&&(uint64_t(st.st_size)>=q.bytes))
+            map = mmap(NULL, q.bytes, PROT_READ, MAP_SHARED, sfd, 0);
+        if (sfd>=0) close(sfd);
+        if (map==MAP_FAILED) map = NULL;
+        mosaic = (uchar*) map;
+    }
+    else {
+        try {
+            if (buf.size()<q.bytes)
+                buf.resize(q.bytes);
+        }
+        catch (const bad_alloc&){
+            cout<<" Service: cannot allocate "<<q.bytes<<" bytes"<<endl;
+            a.status = 1;
+            lf_write_full(fd, &a, sizeof(a));
+            return false; //the mosaic was not read, the stream cannot be resynchronised
+        }
+        if (!lf_read_full(fd, &buf[0], q.bytes))
+            return false;
+        mosaic = &buf[0];
+    }
+    if (!mosaic){
+        cout<<" Service: cannot map "<<q.shm<<endl;
+        a.status = 2;
+        return lf_write_full(fd, &a, sizeof(a));
+    }
+
+    lf.ctx = ctx;
+    lf.lf  = warm;
+    lf_init_maps(&lf);
+    lf.img = Mat(lf.H*lf.V, lf.W*lf.U, CV_8UC3, mosaic);
+    mview2tensor(&lf);
+    lf2depth_compute(&lf);
+    warm = lf.lf;
+    if (map)
+        munmap(map, q.bytes);
+
+    float step = (lf.d_max-lf.d_min)/float(lf.nlabels);
+    Mat disp;
+    lf.depth_f.convertTo(disp, CV_32F, step, lf.d_min);
+
+    a.W = lf.W;
+    a.H = lf.H;
+    a.seconds = (cv::getTickCount()-t0)/cv::getTickFrequency();
+    cout<<" Service: "<<lf.W<<"x"<<lf.H<<" ("<<lf.U<<"x"<<lf.V<<" views, "<<lf.nlabels
+        <<" labels) Done "<<a.seconds<<" Seconds"<<endl;
+
+    size_t map_bytes = size_t(lf.W)*lf.H*sizeof(float);
+    return lf_write_full(fd, &a, sizeof(a)) &&
+           lf_write_full(fd, disp.ptr<float>(0), map_bytes) &&
+           lf_write_full(fd, lf.confidence.ptr<float>(0), map_bytes);
+}
+
+/**
+    Serve depth requests on a Unix-domain socket until the process is terminated.
+    Connections are answered one after the other; a connection may carry any
+    number of requests.
+    @socket_path socket file, replaced if it exists
+    @base        service configuration (the data file is not read)
+    @threads     OpenMP threads, 0 for the OpenMP default
+    @return      1 if the socket cannot be set up
+*/
+int lf_serve(const char* socket_path, const LF& base, int threads){
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path)>=sizeof(addr.sun_path)){
+        cout<<" Service: socket path too long "<<socket_path<<endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if ((sfd<0)||(bind(sfd, (struct sockaddr*) &addr, sizeof(addr))!=0)||(listen(sfd, 8)!=0)){
+        cout<<" Service: cannot listen on "<<socket_path<<endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); //a client leaving early only ends its connection
+
+    lf_context ctx;
+    lf_context_init(&ctx, threads);
+    lf_tensor warm;
+    vector<uchar> buf;
+    cout<<" Service: listening on "<<socket_path<<endl;
+
+    for (;;){
+        int fd = accept(sfd, NULL, NULL);
+        if (fd<0){
+            if (errno==EINTR) continue;
+            break;
+        }
+        while (lf_serve_request(fd, base, &ctx, warm, buf))
+            ;
+        close(fd);
+    }
+
+    close(sfd);
+    lf_context_release(&ctx);
+    return 0;
+}
+
+/**
+    Serve the frames of a shared-memory ring until the producer closes it.
+    Each frame is read in place from its slot (tensor_attach) and its
+    disparity and confidence are written back into the slot.
+    @name        ring name (lf_ring_create of the producer)
+    @base        service configuration; the ring gives the view geometry
+    @threads     OpenMP threads, 0 for the OpenMP default
+    @return      1 if the ring cannot be attached
+*/
+int lf_serve_ring(const char* name, const LF& base, int threads){
+
+    lf_ring_header* h = lf_ring_attach(name);
+    if (!h){
+        cout<<" Ring: cannot attach "<<name<<endl;
+        return 1;
+    }
+    cout<<" Ring: "<<name<<", "<<h->W<<"x"<<h->H<<" ("<<h->U<<"x"<<h->V<<" views), "<<h->slots<<" slots"<<endl;
+
+    lf_context ctx;
+    lf_context_init(&ctx, threads);
+    lf_tensor warm;
+    size_t map_bytes = size_t(h->W)*h->H*sizeof(float);
+    uint64_t next = 0;
+
+    for (;;){
+        if (sem_wait(&h->filled)!=0)
+            continue; //EINTR
+        if (next>=__atomic_load_n(&h->written, __ATOMIC_ACQUIRE)){
+            if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+
+        int64 t0 = cv::getTickCount();
+        unsigned char* slot = lf_ring_slot_ptr(h, next%h->slots);
+        lf_ring_slot*  s    = (lf_ring_slot*) slot;
+
+        LF lf = base;
+        lf.W = h->W;
+        lf.H = h->H;
+        lf.U = h->U;
+        lf.V = h->V;
+        lf_service_scene(&lf);
+        lf.ctx = &ctx;
+        lf.lf  = warm;
+        lf.lf.vflip = 0;
+        lf.lf.map   = NULL;
+        lf_init_maps(&lf);
+        tensor_attach(&lf, slot + h->row_offset, slot + h->col_offset);
+        lf2depth_compute(&lf);
+
+        float step = (lf.d_max-lf.d_min)/float(lf.nlabels);
+        Mat disp;
+        lf.depth_f.convertTo(disp, CV_32F, step, lf.d_min);
+        memcpy(slot + h->disp_offset, disp.ptr<float>(0),          map_bytes);
+        memcpy(slot + h->conf_offset, lf.confidence.ptr<float>(0), map_bytes);
+
+        lf.lf.row8.release(); //views of the slot
+        lf.lf.col8.release();
+        warm = lf.lf;
+
+        s->status  = 0;
+        s->seconds = (cv::getTickCount()-t0)/cv::getTickFrequency();
+        s->done_ns = lf_ring_now_ns();
+        cout<<" Ring: frame "<<s->frame<<" Done "<<s->seconds<<" Seconds"<<endl;
+        sem_post(&h->free);
+        next++;
+    }
+
+    cout<<" Ring: closed after "<<next<<" frames"<<endl;
+    lf_context_release(&ctx);
+    lf_ring_detach(h);
+    return 0;
+}
+
+#endif
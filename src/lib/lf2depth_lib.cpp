@@ -0,0 +1,50 @@
+//  liblf2depth implementation, the only translation unit of the library.
+
+#include "../config.h"
+#include "../light_field.h"
+#include "../lf_container.h"
+#include "../lf2depth.h"
+#include "lf2depth_lib.h"
+
+using namespace std;
+using namespace cv;
+
+struct lf2depth_handle {
+
+    lf_context ctx;
+    Mat        depth;   //filtered depth of the last run
+};
+
+lf2depth_handle* lf2depth_create(int threads){
+
+    lf2depth_handle* h = new lf2depth_handle;
+    lf_context_init(&h->ctx, threads);
+    return h;
+}
+
+bool lf2depth_run(lf2depth_handle* h, const char* config){
+
+    LF lf;
+    config_read(config, &lf);
+    lf.ctx = &h->ctx;
+    bool ok = lf_init(&lf) && lf2depth(&lf);
+    if (ok)
+        h->depth = lf.depth_f.clone();
+    lf_release(&lf);
+    return ok;
+}
+
+const float* lf2depth_result(const lf2depth_handle* h, int* width, int* height){
+
+    if (h->depth.empty())
+        return NULL;
+    *width  = h->depth.cols;
+    *height = h->depth.rows;
+    return h->depth.ptr<float>(0);
+}
+
+void lf2depth_destroy(lf2depth_handle* h){
+
+    lf_context_release(&h->ctx);
+    delete h;
+}
@@ -0,0 +1,40 @@
+//  liblf2depth: depth estimation of a light field scene as a library call. Each handle owns
+//  its context (label table, buffers, threads); runs on different handles may proceed on
+//  concurrent threads of one process. Only this header is public, the pipeline headers
+//  define their functions and are compiled once into the library.
+
+#ifndef _LF2DEPTH_LIB
+#define _LF2DEPTH_LIB
+
+struct lf2depth_handle;
+
+/**
+    Create a handle.
+    @threads      OpenMP threads of its runs, 0 for the OpenMP default
+*/
+lf2depth_handle* lf2depth_create(int threads);
+
+/**
+    Load a scene and extract its depth; the outputs named by the configuration
+    are written as by ./bin/lf2depth and the filtered depth is kept in the handle.
+    @h            handle
+    @config       scene configuration (xml)
+    @return       false if the scene cannot be loaded
+*/
+bool lf2depth_run(lf2depth_handle* h, const char* config);
+
+/**
+    Filtered depth of the last run, in labels, row major.
+    @h            handle
+    @width height size of the depth map as output
+    @return       NULL before the first successful run
+*/
+const float* lf2depth_result(const lf2depth_handle* h, int* width, int* height);
+
+/**
+    Release a handle and everything it owns.
+    @h            handle
+*/
+void lf2depth_destroy(lf2depth_handle* h);
+
+#endif
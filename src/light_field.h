@@ -4,9 +4,93 @@
 #define _LF
 
 #include <opencv2/opencv.hpp>
+#include "gco/GCoptimization.h"
 
 using namespace std;
 using namespace cv;
+
+/**
+    Float light field of the views the EPI cost reads: the central row of views
+    (v = (V-1)/2, every u) and the central column of views (u = (U-1)/2, every v).
+    Sample L(v,u,y,x) is stored at
+        row block    row.at<Vec3f>(1 + u*H + y, x)     for v = (V-1)/2
+        column block col.at<Vec3f>(1 + v*W + x, y)     for u = (U-1)/2
+    so a row of a horizontal EPI (fixed y) and a row of a vertical EPI (fixed x)
+    are both contiguous, and the EPI row of the next view is W*H samples away.
+    The column views are stored transposed for that reason. The first and last
+    line of each block are zeros: the bilinear samples of the outer views may
+    step a few pixels past the first or last view.
+    row8 and col8 hold the same samples in 8-bit for the fixed-point cost; each
+    pair of blocks is only filled when a kernel reads it. With a reduced colour
+    mode the float blocks hold 1 (luminance) or 2 (opponent) channels instead
+    of 3 and the 8-bit blocks are not used.
+*/
+typedef struct {
+
+    int U;
+    int V;
+    int W;
+    int H;
+    int vflip;  //1: the vertical views are stored bottom-up (HCI)
+    int channels;//float channels per sample: 3 (RGB), 2 (opponent) or 1 (luminance)
+    Mat row;    //CV_32FC(channels), U*H+2 lines of W samples
+    Mat col;    //CV_32FC(channels), V*W+2 lines of H samples
+    Mat row8;   //CV_8UC3, same layout as row
+    Mat col8;   //CV_8UC3, same layout as col
+    void*  map;       //read-only file mapping behind row8 and col8 (.lfr input), NULL otherwise
+    size_t map_bytes;
+
+}lf_tensor;
+
+/**
+    Strided view of one EPI inside a lf_tensor: EPI row a (angular view),
+    column x (spatial position) starts at data[(a*rstride + x)*channels]
+    (data8[a*rstride + x] in 8-bit).
+*/
+typedef struct {
+
+    const float* data;  //channels floats per sample
+    const Vec3b* data8;
+    int  channels;  //float channels per sample
+    int  rows;      //number of views
+    int  cols;      //number of spatial positions
+    long rstride;   //distance between two EPI rows in samples, negative when flipped
+
+}epi_view;
+
+/**
+    Large per-scene buffers kept across the scenes of a batch run; a slot is
+    reused whenever the next scene needs at most its size (pool_alloc).
+*/
+enum { LF_POOL_COST_X, LF_POOL_COST_Y, LF_POOL_MEAN_X, LF_POOL_MEAN_Y,
+       LF_POOL_CONF_X, LF_POOL_CONF_Y, LF_POOL_MERGED, LF_POOL_MRF_DATA, LF_POOL_SLOTS };
+
+typedef struct {
+
+    void*  ptr[LF_POOL_SLOTS];
+    size_t bytes[LF_POOL_SLOTS];
+    long   reused;      //allocations served from the pool
+    long   allocated;   //allocations that had to grow a slot
+
+}lf_pool;
+
+/**
+    State of a depth estimation that is not part of the scene: the label to
+    disparity table, the reusable buffers and the thread count. Estimations
+    with their own context can run on concurrent threads of one process.
+*/
+typedef struct lf_context {
+
+    float*  disp;       //label to disparity table, nlabels+1 entries (disparity_table)
+    int     ndisp;      //capacity of disp
+    int     threads;    //OpenMP threads of a run, 0 for the OpenMP default
+    lf_pool pool;       //cost volume buffers, kept between the runs of the context
+    GCoptimization::DynamicGraph* mrf_graphs; //MRF graphs kept for the next frame (MRF_DYNAMIC)
+    int     nmrf_graphs;
+    int     private_run;//1: private context of a single run (lf2depth_compute), released with it
+
+}lf_context;
+
 /**
     the structure of light field containing all parameters and data
 */
@@ -27,6 +111,23 @@ typedef struct {
     float dt_max;
     int   threshold;//for mrf
     float lambda;  //for mrf
+    int   mrf_graph;//0: general graph (setNeighbors), 1: grid graph with edge weights
+    int   mrf_datacost;//0: table of nlabels costs per pixel, 1: read lazily from the cost volumes, 2: table of the non-free sites
+    int   mrf_pool;  //1: expansion graph kept and reset across moves (GCO pool mode)
+    int   mrf_dynamic;//0: off, 1: one dynamic graph for all moves and frames, 2: one per label (GCO dynamic mode), grid graph only
+    int   window;  //angular window of the cost (number of views)
+    int   simd;    //0: scalar reference cost kernel, 1: vectorized if the CPU supports it
+    int   cost_engine;//0: per-pixel label sweep, 1: label-outer plane sweep, 2: 8-bit fixed-point plane sweep
+    int   pipeline;  //0: full cost volumes, 1: fused streaming winner-take-all (no MRF)
+    int   cost_type; //0: float, 1: uint16, 2: half cost volumes
+    float cost_scale;//quantization scale of the cost volumes, 0: derived from the cost bound
+    int   verify;    //1: measure the quantized result against the float volumes
+    int   c2f_step;  //label step of the coarse-to-fine search, 0 or 1: full label sweep
+    int   c2f_band;  //half width of the full resolution label band around the coarse minimum
+    int   subpixel;  //0: integer labels, 1: parabola fit, 2: equiangular line fit at the cost minimum
+    int   color_mode;//0: RGB cost, 1: luminance, 2: two channel opponent (intensity, red-green)
+    float q_cost;    //encoding scale in use for the cost volumes
+    float q_mean;    //encoding scale in use for the mean volumes
     double focalLength;
     double shift;
     double baseline;
@@ -38,9 +139,11 @@ typedef struct {
     string depth_filter_filename;
     string erro_map_filename;
     string centre_view_filename;
+    string cache_dir;   //cost cache directory, empty: no cache
 
     //data container
-    vector<Mat> epi_h, epi_v;
+    lf_context* ctx;  //table, buffers and threads of the run, NULL: a private context (lf2depth)
+    lf_tensor lf;
     unsigned char* lf_raw;
     Mat depth;
     Mat depth_f;
@@ -57,21 +160,319 @@ typedef struct {
 
 
 /**
-    Extract the vertical and horizontal epi slices from multiviw image array (colour).
-    @epi_h   the horizontal slice vector
-    @epi_v   the vertical slice vector     
+    Buffer of a pool slot of the context (calloc without a context).
+    @lf_ptr  the pointer of light field structure
+    @slot    LF_POOL_* slot
+    @bytes   size of the buffer
+    @zero    clear the buffer; false when the caller overwrites all of it
+*/
+void* pool_alloc(LF* lf_ptr, int slot, size_t bytes, bool zero = true){
+
+    lf_pool* p = lf_ptr->ctx ? &lf_ptr->ctx->pool : NULL;
+    if (!p)
+        return calloc(bytes, 1);
+
+    if (p->bytes[slot]<bytes){
+        free(p->ptr[slot]);
+        p->ptr[slot]   = calloc(bytes, 1);
+        p->bytes[slot] = bytes;
+        p->allocated++;
+    }
+    else {
+        if (zero)
+            memset(p->ptr[slot], 0, bytes);
+        p->reused++;
+    }
+    return p->ptr[slot];
+}
+
+/**
+    Give back a buffer of pool_alloc; pooled buffers stay for the next run.
+    @lf_ptr  the pointer of light field structure
+    @ptr     buffer
+*/
+void pool_free(LF* lf_ptr, void* ptr){
+
+    if (!lf_ptr->ctx)
+        free(ptr);
+}
+
+/**
+    Give back a buffer that is dead long before the end of a run. A private
+    context of a single run frees it now, to lower the peak of the run; a
+    shared context (batch, service, ring) keeps it warm for the next run.
+    @lf_ptr  the pointer of light field structure
+    @slot    LF_POOL_* slot of the buffer
+    @ptr     buffer
+*/
+void pool_release_slot(LF* lf_ptr, int slot, void* ptr){
+
+    lf_pool* p = lf_ptr->ctx ? &lf_ptr->ctx->pool : NULL;
+    if (!p){
+        free(ptr);
+        return;
+    }
+    if (!lf_ptr->ctx->private_run)
+        return;
+    free(p->ptr[slot]);
+    p->ptr[slot]   = NULL;
+    p->bytes[slot] = 0;
+}
+
+/**
+    Free every slot of a pool.
+    @p       pool
+*/
+void pool_release(lf_pool* p){
+
+    for (int n=0; n<LF_POOL_SLOTS; n++){
+        free(p->ptr[n]);
+        p->ptr[n]   = NULL;
+        p->bytes[n] = 0;
+    }
+}
+
+/**
+    Set up an empty context.
+    @ctx     context
+    @threads OpenMP threads of its runs, 0 for the OpenMP default
+*/
+void lf_context_init(lf_context* ctx, int threads){
+
+    memset(ctx, 0, sizeof(lf_context));
+    ctx->threads = threads;
+}
+
+/**
+    Free the table, the buffers and the MRF graphs of a context.
+    @ctx     context
+*/
+void lf_context_release(lf_context* ctx){
+
+    delete[] ctx->disp;
+    ctx->disp  = NULL;
+    ctx->ndisp = 0;
+    pool_release(&ctx->pool);
+    delete[] ctx->mrf_graphs;
+    ctx->mrf_graphs  = NULL;
+    ctx->nmrf_graphs = 0;
+}
+
+/**
+    Settle the parameters that have defaults or limits (label count, angular
+    window, coarse-to-fine band) before anything depends on them, e.g. the
+    cost cache key. Running it again changes nothing.
+    @lf_ptr  the pointer of light field structure
+*/
+void lf_init_params(LF* lf_ptr){
+
+    if (lf_ptr->nlabels<=0)
+        lf_ptr->nlabels=64;
+    if (lf_ptr->nlabels>65536){
+        cout<<" Too many labels "<<lf_ptr->nlabels<<", using 65536"<<endl;
+        lf_ptr->nlabels=65536;
+    }
+
+    //angular window: the cost kernels exist for 5/7/9/13/15 views
+    int w = lf_ptr->window;
+    if (((w!=5)&&(w!=7)&&(w!=9)&&(w!=13)&&(w!=15))||(w>lf_ptr->U)||(w>lf_ptr->V)){
+        cout<<" Unsupported angular window "<<w<<", using 7 views"<<endl;
+        lf_ptr->window = 7;
+    }
+
+    //coarse-to-fine band: one coarse step on each side by default
+    if ((lf_ptr->c2f_step>1)&&(lf_ptr->c2f_band<=0))
+        lf_ptr->c2f_band = lf_ptr->c2f_step;
+}
+
+/**
+    Horizontal EPI of image row j: the central row of views at row j.
+    @lf_ptr  the pointer of light field structure
+    @j       image row
+*/
+epi_view epi_h(const LF* lf_ptr, int j){
+
+    const lf_tensor& t = lf_ptr->lf;
+    epi_view e;
+    e.data    = t.row.empty()  ? NULL : (const float*) t.row.ptr(1+j);
+    e.data8   = t.row8.empty() ? NULL : (const Vec3b*) t.row8.ptr(1+j);
+    e.channels= t.channels;
+    e.rows    = t.U;
+    e.cols    = t.W;
+    e.rstride = long(t.H)*t.W;
+    return e;
+}
+
+/**
+    Vertical EPI of image column i: the central column of views at column i.
+    @lf_ptr  the pointer of light field structure
+    @i       image column
+*/
+epi_view epi_v(const LF* lf_ptr, int i){
+
+    const lf_tensor& t = lf_ptr->lf;
+    epi_view e;
+    e.channels= t.channels;
+    e.rows    = t.V;
+    e.cols    = t.H;
+    e.rstride = long(t.W)*t.H;
+    e.data    = t.col.empty()  ? NULL : (const float*) t.col.ptr(1+i);
+    e.data8   = t.col8.empty() ? NULL : (const Vec3b*) t.col8.ptr(1+i);
+    if (t.vflip){
+        if (e.data)  e.data  = e.data  + (t.V-1)*e.rstride*t.channels;
+        if (e.data8) e.data8 = e.data8 + (t.V-1)*e.rstride;
+        e.rstride = -e.rstride;
+    }
+    return e;
+}
+
+/**
+    First float of EPI row a (angular view).
+    @e       EPI view
+    @a       EPI row
+*/
+inline const float* epi_row(const epi_view& e, int a){
+
+    return e.data + a*e.rstride*e.channels;
+}
+
+/**
+    Reduce an 8-bit BGR pixel to the channels of a colour mode. Luminance is the
+    Rec. 601 luma; the opponent pair is the intensity and the red-green difference
+    offset to [0, 255], so both keep the 8-bit range the cost bound assumes.
+    @p       BGR pixel
+    @out     1 or 2 channels as output
+    @mode    1: luminance, 2: opponent
+*/
+inline void color_reduce(const Vec3b& p, float* out, int mode){
+
+    if (mode==1)
+        out[0] = 0.114f*p[0] + 0.587f*p[1] + 0.299f*p[2];
+    else{
+        out[0] = (float(p[0]) + float(p[1]) + float(p[2]))*(1.0f/3.0f);
+        out[1] = 0.5f*(float(p[2]) - float(p[1])) + 127.5f;
+    }
+}
+
+/**
+    Allocate a tensor block with its two padding rows cleared. The buffer is
+    kept when the block already has this size (a resident process reuses it),
+    the rows in between are all written by the conversion.
+    @m       tensor block
+    @rows cols type  block geometry
+*/
+void tensor_block(Mat& m, int rows, int cols, int type){
+
+    m.create(rows, cols, type);
+    memset(m.ptr(0),      0, m.cols*m.elemSize());
+    memset(m.ptr(rows-1), 0, m.cols*m.elemSize());
+}
+
+/**
+    Fill the float blocks of the tensor from its 8-bit blocks (same layout, so a
+    plain widening with the colour reduction, no transpose).
+    @t       tensor with row8 and col8 set
+    @mode    colour mode (lf_ptr->color_mode)
+*/
+void tensor_widen(lf_tensor& t, int mode){
+
+    t.channels = (mode==1) ? 1 : (mode==2) ? 2 : 3;
+    tensor_block(t.row, t.row8.rows, t.row8.cols, CV_32FC(t.channels));
+    tensor_block(t.col, t.col8.rows, t.col8.cols, CV_32FC(t.channels));
+
+    Mat* src[2] = { &t.row8, &t.col8 };
+    Mat* dst[2] = { &t.row,  &t.col  };
+    for (int b=0; b<2; b++){
+        #pragma omp parallel for
+        for (int j=1; j<src[b]->rows-1; j++){
+            const Vec3b* in  = (const Vec3b*) src[b]->ptr(j);
+            float*       out = (float*) dst[b]->ptr(j);
+            for (int i=0; i<src[b]->cols; i++){
+                if (mode!=0)
+                    color_reduce(in[i], out + i*t.channels, mode);
+                else
+                    for (int m=0; m<3; m++)
+                        out[3*i+m] = in[i][m];
+            }
+        }
+    }
+}
+
+/**
+    Use 8-bit tensor blocks held outside the structure (a .lfr mapping, a ring
+    slot) in place: the float blocks are only widened from them when a kernel
+    reads them, and the central view is copied out.
+    @lf_ptr     light field structure pointer (geometry, colour mode and engine set)
+    @row8       central row of views,    (U*H+2) x W BGR
+    @col8       central column of views, (V*W+2) x H BGR, transposed
+*/
+void tensor_attach(LF* lf_ptr, unsigned char* row8, unsigned char* col8){
+
+    int W = lf_ptr->W;
+    int H = lf_ptr->H;
+    int U = lf_ptr->U;
+    int V = lf_ptr->V;
+    lf_tensor& t = lf_ptr->lf;
+
+    t.U = U;
+    t.V = V;
+    t.W = W;
+    t.H = H;
+    t.row8 = Mat(U*H+2, W, CV_8UC3, row8);
+    t.col8 = Mat(V*W+2, H, CV_8UC3, col8);
+
+    //same block selection as mview2tensor; the 8-bit blocks cost nothing to keep
+    int  mode  = lf_ptr->color_mode;
+    bool fixed = (lf_ptr->cost_engine==2)&&(mode==0);
+    bool flt   = (!fixed)||(lf_ptr->verify==1)||(lf_ptr->c2f_step>1);
+    t.channels = (mode==1) ? 1 : (mode==2) ? 2 : 3;
+    if (flt)
+        tensor_widen(t, mode);
+
+    //central view: view (U-1)/2 of the central row of views
+    lf_ptr->imgc = t.row8.rowRange(1+H*((U-1)/2), 1+H*((U-1)/2)+H).clone();
+    if (!lf_ptr->centre_view_filename.empty())
+        imwrite(lf_ptr->centre_view_filename.c_str(), lf_ptr->imgc);
+}
+
+/**
+    Fill the light field tensor from the multiview image array (colour) and
+    extract the central view. This is the only conversion of the views; the
+    EPIs are views into the tensor (epi_h, epi_v).
     @lf_ptr  the pointer of light field structure    
 */
-void mview2epis(vector<Mat>& epi_h, vector<Mat>& epi_v, LF* lf_ptr){
+void mview2tensor(LF* lf_ptr){
 
-	epi_h.resize(lf_ptr->W);
-	epi_v.resize(lf_ptr->W);	
+    int W = lf_ptr->W;
+    int H = lf_ptr->H;
+    int U = lf_ptr->U;
+    int V = lf_ptr->V;
+    lf_tensor& t = lf_ptr->lf;
 
-    for (int i=0; i<lf_ptr->W; i++){
-        epi_h[i] = Mat(lf_ptr->V, lf_ptr->W, CV_32FC3);
-        epi_v[i] = Mat(lf_ptr->U, lf_ptr->H, CV_32FC3);  
+    t.U = U;
+    t.V = V;
+    t.W = W;
+    t.H = H;
+    t.vflip = (lf_ptr->type==0); //HCI views are numbered bottom-up
+    t.map   = NULL;
+    t.map_bytes = 0;
+    int mode   = lf_ptr->color_mode;
+    t.channels = (mode==1) ? 1 : (mode==2) ? 2 : 3;
+
+    //the 8-bit engine alone reads the 8-bit blocks; the float ones stay for the
+    //other kernels, the coarse-to-fine range kernels and the float verification.
+    //The reduced colour modes always run on the float blocks.
+    bool fixed = (lf_ptr->cost_engine==2)&&(mode==0);
+    bool flt   = (!fixed)||(lf_ptr->verify==1)||(lf_ptr->c2f_step>1);
+    if (flt){
+        tensor_block(t.row, U*H+2, W, CV_32FC(t.channels));
+        tensor_block(t.col, V*W+2, H, CV_32FC(t.channels));
+    }
+    if (fixed){
+        tensor_block(t.row8, U*H+2, W, CV_8UC3);
+        tensor_block(t.col8, V*W+2, H, CV_8UC3);
     }
-    
+
 	//mulitple view denoising
 	/*
     for (int m = 1; m < lf_ptr->V-1; m++)
@@ -82,50 +483,47 @@ void mview2epis(vector<Mat>& epi_h, vector<Mat>& epi_v, LF* lf_ptr){
 	imwrite("tuilip.png", lf_ptr->img);
 	*/
     //extract central view
-    lf_ptr->imgc = Mat(lf_ptr->H,lf_ptr->W,CV_8UC3);
-
-    for (int j=0; j<lf_ptr->H; j++) 
-        for (int i = 0; i < lf_ptr->W; i++)
-            lf_ptr->imgc.at<Vec3b>(j,i)=lf_ptr->img.at<Vec3b>(lf_ptr->H*(lf_ptr->V-1)/2+j,lf_ptr->W*(lf_ptr->U-1)/2+i); 
-
-	
-    imwrite(lf_ptr->centre_view_filename.c_str(), lf_ptr->imgc);
-
-    //===horizontal epi slices===
-    for (int j=0; j<lf_ptr->H; j++){
-        for (int n = 0; n < lf_ptr->U; n++)
-            for (int i = 0; i < lf_ptr->W; i++){ 			
-				Vec3f a = lf_ptr->img.at<Vec3b>(lf_ptr->H*((lf_ptr->V-1)/2)+j,n*lf_ptr->W+i);
-				//Vec3f b = lf_ptr->img.at<Vec3b>(lf_ptr->H*((lf_ptr->V-1)/2-1)+j,n*lf_ptr->W+i);	
-				//Vec3f c = lf_ptr->img.at<Vec3b>(lf_ptr->H*((lf_ptr->V-1)/2+1)+j,n*lf_ptr->W+i);
-				//Vec3f d = lf_ptr->img.at<Vec3b>(lf_ptr->H*((lf_ptr->V-1)/2-2)+j,n*lf_ptr->W+i);	
-				//Vec3f e = lf_ptr->img.at<Vec3b>(lf_ptr->H*((lf_ptr->V-1)/2+2)+j,n*lf_ptr->W+i);
-                epi_h[j].at<Vec3f>(n,i)  = a;//(a+b+c+d+e)*0.2;   
-            }    
-         //if (j==100) imwrite("./debug/epi_v100.png", epi_h[j]);    
-         //if (j==200) imwrite("./debug/epi_v100.png", epi_h[j]);          
-         //if (j==400) imwrite("./debug/epi_v400.png", epi_h[j]);      
-    }        
-   
-    //===vertical epi slices===
-    for (int i=0; i<lf_ptr->W; i++) 
-        for (int m = 0; m < lf_ptr->V; m++)
-            for (int j = 0; j < lf_ptr->H; j++) { 
-            
-                if (lf_ptr->type==0){//HCI{
-                epi_v[i].at<Vec3f>(lf_ptr->V-1-m,j)
-                 = (Vec3f) lf_ptr->img.at<Vec3b>(m*lf_ptr->H+j, lf_ptr->W*((lf_ptr->U-1)/2)+i);                 
-                }  
-                else  if (lf_ptr->type==1){//LYTRO}
-				Vec3f a = lf_ptr->img.at<Vec3b>(m*lf_ptr->H+j, lf_ptr->W*( lf_ptr->U-1)/2   +i);
-				//Vec3f b = lf_ptr->img.at<Vec3b>(m*lf_ptr->H+j, lf_ptr->W*((lf_ptr->U-1)/2-1)+i);
-				//Vec3f c = lf_ptr->img.at<Vec3b>(m*lf_ptr->H+j, lf_ptr->W*((lf_ptr->U-1)/2+1)+i);
-				//Vec3f d = lf_ptr->img.at<Vec3b>(m*lf_ptr->H+j, lf_ptr->W*((lf_ptr->U-1)/2-1)+i);
-				//Vec3f e = lf_ptr->img.at<Vec3b>(m*lf_ptr->H+j, lf_ptr->W*((lf_ptr->U-1)/2+1)+i);
-                epi_v[i].at<Vec3f>(m,j) = a;//(a+b+c+d+e)*0.2;                   
-                //if (i==500) imwrite("./debug/epi_v500.png", epi_v[i]);    
-				}                      
-            }                       
+    lf_ptr->imgc = Mat(H,W,CV_8UC3);
+
+    for (int j=0; j<H; j++) 
+        for (int i = 0; i < W; i++)
+            lf_ptr->imgc.at<Vec3b>(j,i)=lf_ptr->img.at<Vec3b>(H*(V-1)/2+j,W*(U-1)/2+i); 
+
+    if (!lf_ptr->centre_view_filename.empty())
+        imwrite(lf_ptr->centre_view_filename.c_str(), lf_ptr->imgc);
+
+    //===central row of views===
+    #pragma omp parallel for
+    for (int n = 0; n < U; n++)
+        for (int j=0; j<H; j++){
+            const Vec3b* src = lf_ptr->img.ptr<Vec3b>(H*((V-1)/2)+j) + n*W;
+            if (flt&&(mode!=0)){
+                float* dst = (float*) t.row.ptr(1+n*H+j);
+                for (int i = 0; i < W; i++)
+                    color_reduce(src[i], dst + i*t.channels, mode);
+            }
+            else if (flt){
+                Vec3f* dst = t.row.ptr<Vec3f>(1+n*H+j);
+                for (int i = 0; i < W; i++)
+                    dst[i] = src[i];
+            }
+            if (fixed)
+                memcpy(t.row8.ptr(1+n*H+j), src, W*sizeof(Vec3b));
+        }
+
+    //===central column of views, transposed===
+    #pragma omp parallel for
+    for (int m = 0; m < V; m++)
+        for (int j = 0; j < H; j++){
+            const Vec3b* src = lf_ptr->img.ptr<Vec3b>(m*H+j) + W*((U-1)/2);
+            for (int i=0; i<W; i++){
+                if (flt&&(mode!=0))
+                    color_reduce(src[i], (float*) t.col.ptr(1+m*W+i) + j*t.channels, mode);
+                else if (flt)
+                    t.col.at<Vec3f>(1+m*W+i, j)  = src[i];
+                if (fixed) t.col8.at<Vec3b>(1+m*W+i, j) = src[i];
+            }
+        }
 }
 
 #endif
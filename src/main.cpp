@@ -32,50 +32,208 @@
  
 #include "config.h"
 #include "light_field.h"
+#include "lf_container.h"
 #include "lf2depth.h"
 #include "lf2depth_stereo.h"
+#include "lf_service.h"
 #include "misc.h"
+#include <thread>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/resource.h>
 
 using namespace std;
 using namespace cv;
 /**
-    Initialize light field structure and load data.
-    @lf_ptr          light field strutue pointer 
+    One scene of a batch run.
 */
-void lf_init(LF* lf_ptr){
-
-    lf_ptr->depth         =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
-    lf_ptr->depth_f       =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
-    lf_ptr->depth_x       =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);
-    lf_ptr->depth_y       =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);
-    lf_ptr->confidence    =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
-    lf_ptr->confidence_x  =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);
-    lf_ptr->confidence_y  =Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32FC3);  
-
-    if (lf_ptr->mask==1)
-        lf_ptr->disparity_mask = Mat::zeros(lf_ptr->H,lf_ptr->W,CV_32F);
-    else
-        lf_ptr->disparity_mask = Mat::ones( lf_ptr->H,lf_ptr->W,CV_32F);  
-
-    if (lf_ptr->type==0)//HCI data
-        loadh5_mat(lf_ptr);
-    else//Lytro dat   
-        lf_ptr->img=imread(lf_ptr->data_filename.c_str()); 
-      
-    mview2epis(lf_ptr->epi_h, lf_ptr->epi_v, lf_ptr);//convert multiview to EPI slices  
+typedef struct {
+
+    string config;
+    LF*    lf;
+    bool   loaded;
+    bool   done;
+    double load_time;   //config, decode and tensor, overlapped with the previous scene
+    double run_time;    //lf2depth
+    long   peak_rss;    //process peak after the scene, MB
+
+}batch_scene;
+
+/**
+    Collect the configurations of a batch run: every .xml of a directory
+    (sorted), the lines of a list file, or the arguments themselves.
+    @argc argv       command line, the inputs start at argv[2]
+*/
+vector<string> batch_configs(int argc, const char* argv[]){
+
+    vector<string> configs;
+    for (int n=2; n<argc; n++){
+
+        string arg = argv[n];
+        DIR* dir = opendir(arg.c_str());
+        if (dir){
+            vector<string> xml;
+            for (struct dirent* e=readdir(dir); e; e=readdir(dir)){
+                string name = e->d_name;
+                if ((name.size()>4)&&(name.compare(name.size()-4, 4, ".xml")==0))
+                    xml.push_back(arg + "/" + name);
+            }
+            closedir(dir);
+            sort(xml.begin(), xml.end());
+            configs.insert(configs.end(), xml.begin(), xml.end());
+        }
+        else if ((arg.size()>4)&&(arg.compare(arg.size()-4, 4, ".xml")==0))
+            configs.push_back(arg);
+        else{ //list file, one configuration per line, # comments
+            ifstream in(arg.c_str());
+            string line;
+            while (getline(in, line)){
+                line.erase(0, line.find_first_not_of(" \t"));
+                line.erase(line.find_last_not_of(" \t\r")+1);
+                if ((!line.empty())&&(line[0]!='#'))
+                    configs.push_back(line);
+            }
+        }
+    }
+    return configs;
+}
+
+/**
+    Read the configuration of a batch scene and load its data.
+    @s               batch scene
+    @ctx             context shared by the scenes
+*/
+void batch_load(batch_scene* s, lf_context* ctx){
+
+    int64 t0 = cv::getTickCount();
+    s->lf = new LF;
+    config_read(s->config.c_str(), s->lf);
+    s->lf->ctx = ctx;
+    s->loaded = lf_init(s->lf);
+    s->load_time = (cv::getTickCount()-t0)/cv::getTickFrequency();
+}
+
+/**
+    Run many scenes in one process: the next scene is loaded on a second
+    thread while the current one computes, the OpenMP team and the cost
+    volume buffers stay alive across scenes, and a table of per-scene
+    timings is printed and written to ./out/batch_summary.txt.
+    @configs         scene configurations
+    @return          number of failed scenes
+*/
+int lf2depth_batch(const vector<string>& configs){
+
+    int64 t0 = cv::getTickCount();
+    int n = configs.size();
+    vector<batch_scene> scenes(n);
+    for (int i=0; i<n; i++){
+        scenes[i].config = configs[i];
+        scenes[i].lf     = NULL;
+        scenes[i].loaded = scenes[i].done = false;
+        scenes[i].load_time = scenes[i].run_time = 0;
+        scenes[i].peak_rss  = 0;
+    }
+
+    lf_context ctx; //the scenes run one after the other, one context for all
+    lf_context_init(&ctx, 0);
+
+    thread loader;
+    if (n>0)
+        loader = thread(batch_load, &scenes[0], &ctx);
+
+    for (int i=0; i<n; i++){
+
+        loader.join();
+        if (i+1<n) //prefetch the next scene
+            loader = thread(batch_load, &scenes[i+1], &ctx);
+
+        batch_scene& s = scenes[i];
+        cout<<"=================Start====================  "<<s.config<<endl;
+        if (s.loaded){
+            int64 t1 = cv::getTickCount();
+            s.done = lf2depth(s.lf);
+            s.run_time = (cv::getTickCount()-t1)/cv::getTickFrequency();
+        }
+        lf_release(s.lf);
+
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        s.peak_rss = ru.ru_maxrss/1024;
+        cout<<"=================Finish===================="<<endl;
+    }
+
+    ostringstream table;
+    int failed = 0;
+    table<<left<<setw(40)<<"scene"<<setw(12)<<"size"<<setw(8)<<"labels"
+         <<right<<setw(10)<<"load s"<<setw(10)<<"run s"<<setw(10)<<"peak MB"<<"  status"<<endl;
+    for (int i=0; i<n; i++){
+        const batch_scene& s = scenes[i];
+        ostringstream size;
+        size<<s.lf->W<<"x"<<s.lf->H;
+        table<<left<<setw(40)<<s.config<<setw(12)<<size.str()<<setw(8)<<s.lf->nlabels
+             <<right<<fixed<<setprecision(3)<<setw(10)<<s.load_time<<setw(10)<<s.run_time
+             <<setw(10)<<s.peak_rss<<"  "<<(s.done ? "ok" : s.loaded ? "failed" : "load failed")<<endl;
+        failed += !s.done;
+        delete s.lf;
+    }
+    table<<n<<" scenes, "<<failed<<" failed, "<<fixed<<setprecision(3)
+         <<(cv::getTickCount()-t0)/cv::getTickFrequency()<<" Seconds, buffers reused "
+         <<ctx.pool.reused<<" allocated "<<ctx.pool.allocated<<endl;
+    lf_context_release(&ctx);
+
+    cout<<"=================Batch====================="<<endl<<table.str();
+    ofstream out("./out/batch_summary.txt");
+    out<<table.str();
+    return failed;
 }
 
 
 //==================Main Function===========================
 //command usage ./bin/depth ./config/HCI/papillon.xml
+//              ./bin/depth --convert ./config/LYTRO/bus.xml ./in/LYTRO/bus.lfr
+//              ./bin/depth --batch ./config/LYTRO [list.txt scene.xml ...]
+//              ./bin/depth --serve /tmp/lf2depth.sock ./config/LYTRO/bus.xml [threads]
+//              ./bin/depth --ring /lf2depth_ring ./config/LYTRO/bus.xml [threads]
 //==========================================================
 
 int main(int argc, const char *argv[]) {
+
+    if ((argc>3)&&(string(argv[1])=="--convert")){ //write the scene as a .lfr container
+        cout<<"=================Convert==================  "<<argv[2]<<endl;
+        LF lf;
+        config_read(argv[2], &lf);
+        lf.cost_engine = 2; //the container holds the 8-bit tensor blocks
+        lf.color_mode  = 0;
+        lf.verify      = 0;
+        lf.c2f_step    = 0;
+        if (!lf_init(&lf))
+            return 1;
+        return lfr_write(argv[3], &lf) ? 0 : 1;
+    }
+
+    if ((argc>2)&&(string(argv[1])=="--batch")) //many scenes in one process
+        return lf2depth_batch(batch_configs(argc, argv)) ? 1 : 0;
+
+    if ((argc>3)&&(string(argv[1])=="--serve")){ //resident service, the configuration gives the defaults
+        LF base;
+        config_read(argv[3], &base);
+        return lf_serve(argv[2], base, (argc>4) ? atoi(argv[4]) : 0);
+    }
+
+    if ((argc>3)&&(string(argv[1])=="--ring")){ //frames of a shared-memory ring, in place
+        LF base;
+        config_read(argv[3], &base);
+        return lf_serve_ring(argv[2], base, (argc>4) ? atoi(argv[4]) : 0);
+    }
+
     cout<<"=================Start====================  "<<argv[1]<<endl;
     LF lf;
 
     config_read(argv[1], &lf); //load xml configuration file
-    lf_init(&lf);
+    if (!lf_init(&lf))
+        return 1;
     lf2depth(&lf);//Depth extraction
 
     //int64 t0, t1;
@@ -85,8 +243,7 @@ int main(int argc, const char *argv[]) {
     //t1 = cv::getTickCount();   
     //cout<<"Time spent "<<(t1-t0)/cv::getTickFrequency()<<" Seconds"<<endl;  
 
-    if (lf.type==0)
-    delete[] lf.lf_raw;
+    lf_release(&lf);
 
     cout<<"=================Finish===================="<<endl;
     return 0;
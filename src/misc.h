@@ -4,6 +4,7 @@
 #define _MISC
 
 #include <limits>
+#include <sys/resource.h>
 #include <opencv2/opencv.hpp>
 #include "WMF/JointWMF.h"
 #include "light_field.h"
@@ -14,15 +15,17 @@ using namespace cv;
 
 /**
     Convert integer disparity value to depth in float type.
-    @depth          input disparity (uchar)
+    @depth          input disparity (8 or 16-bit labels)
     @depth2         output depth (float)
     @lf_ptr         light field strutue pointer
 */
 void label2depth( Mat& depth, Mat& depth2, LF* lf_ptr){
 
+    Mat label;
+    depth.convertTo(label, CV_32F);
     for (int j = 0; j < lf_ptr->H; j++)
         for (int i = 0; i < lf_ptr->W; i++) 
-            depth2.at<float>(j,i)=lf_ptr->dt_min+(float)depth.at<uchar>(j,i)*float(lf_ptr->dt_max-lf_ptr->dt_min)/(float)lf_ptr->nlabels;        
+            depth2.at<float>(j,i)=lf_ptr->dt_min+label.at<float>(j,i)*float(lf_ptr->dt_max-lf_ptr->dt_min)/(float)lf_ptr->nlabels;        
 }
 
 /**
@@ -167,13 +170,14 @@ void grey_map(const Mat& img, const char* dir, int flag){
     @data_best_xy       output result
     @lf_ptr             light field strutue pointer
 */
-void depth_merge_gt(  uchar* data_best_x, uchar* data_best_y, uchar* data_best_xy, LF* lf_ptr){
+template<typename LabelT>
+void depth_merge_gt(  LabelT* data_best_x, LabelT* data_best_y, LabelT* data_best_xy, LF* lf_ptr){
 
     int height = lf_ptr->H;
     int width  = lf_ptr->W;
 
-    Mat depth_matx( height, width, CV_8U, data_best_x);
-    Mat depth_maty( height, width, CV_8U, data_best_y);  
+    Mat depth_matx( height, width, DataType<LabelT>::type, data_best_x);
+    Mat depth_maty( height, width, DataType<LabelT>::type, data_best_y);  
     Mat depth_matx2( height, width, CV_32F);
     Mat depth_maty2( height, width, CV_32F);        
     label2depth( depth_matx, depth_matx2, lf_ptr);      
@@ -269,12 +273,15 @@ for (int j=6; j<(depth.rows-6); j++)
     @lf_ptr          light field strutue pointer 
 */
 
-void evaluate_depth(uchar* depth, const char* filename, LF* lf_ptr){
+template<typename LabelT>
+void evaluate_depth(LabelT* depth, const char* filename, LF* lf_ptr){
 
     int width  = lf_ptr->W;
     int height = lf_ptr->H;
 
-    Mat depth_mat2( height, width, CV_8U, depth);
+    Mat depth_mat2( height, width, DataType<LabelT>::type, depth);
+    if (depth_mat2.depth()!=CV_8U) //the filter takes 8-bit or float input
+        depth_mat2.convertTo(depth_mat2, CV_32F);
     
     //===median blur
     //medianBlur ( depth_mat2, depth_mat2, 5);
@@ -283,10 +290,45 @@ void evaluate_depth(uchar* depth, const char* filename, LF* lf_ptr){
     Mat img_grey;
     cvtColor(lf_ptr->imgc, img_grey, CV_RGB2GRAY);
     JointWMF wmf;
-    depth_mat2=wmf.filter(depth_mat2, img_grey, 5, 25.5, 64, 256, 1, "exp");//cos
+    depth_mat2=wmf.filter(depth_mat2, img_grey, 5, 25.5, lf_ptr->nlabels, 256, 1, "exp");//cos
     Mat depth_mat( height, width, CV_32F);
     label2depth( depth_mat2, depth_mat, lf_ptr);
     error_comparison(depth_mat, lf_ptr->disparity_gt, lf_ptr->disparity_mask, filename);  
 }
-#endif
 
+/**
+    Sub-label position of a cost minimum from the costs of the label and its two
+    neighbours. A parabola fits smooth (variance) costs, the equiangular line
+    fits costs with a V shaped minimum.
+    @c0 c1 c2        costs at the labels k-1, k and k+1
+    @mode            1: parabola, 2: equiangular line
+    @return          offset in [-0.5, 0.5] to add to k, 0 if k is not a local minimum
+*/
+float subpixel_offset(float c0, float c1, float c2, int mode){
+
+    if ((c1>c0)||(c1>c2))
+        return 0;
+
+    float den = 0;
+    if (mode==1)
+        den = 2*(c0 - 2*c1 + c2);
+    else if (mode==2)
+        den = 2*((c0>c2) ? (c0-c1) : (c2-c1));
+    if (den<=0)
+        return 0;
+
+    float off = (c0-c2)/den;
+    return (off<-0.5f) ? -0.5f : (off>0.5f) ? 0.5f : off;
+}
+
+/**
+    Peak resident set size of the process so far.
+    @return          peak RSS in MB
+*/
+double peak_rss_mb(){
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0; //ru_maxrss is in KB on Linux
+}
+#endif
@@ -0,0 +1,25 @@
+echo "$(tput setaf 3)-------------------------------------------$(tput sgr0)"
+echo "$(tput setaf 3)--       LF2DEPTH ACCURACY VS LABELS     --$(tput sgr0)"
+echo "$(tput setaf 3)-------------------------------------------$(tput sgr0)"
+
+#usage: ./test_hci_labels.sh ./config/HCI/papillon.xml
+#runs the scene for several label counts with integer labels (SUBPIXEL 0),
+#parabola (1) and equiangular (2) refinement and keeps the ground truth errors
+config=$1
+name=$(date '+%y_%m_%d_%s')
+tmp=./out/labels_$name.xml
+log=./out/labels_$name.txt
+
+for labels in 16 24 32 48 64; do
+    for subpixel in 0 1 2; do
+        sed -e 's|<NUM_LABELS>.*</NUM_LABELS>||' -e 's|<SUBPIXEL>.*</SUBPIXEL>||' \
+            -e "s|</opencv_storage>|<NUM_LABELS>$labels</NUM_LABELS><SUBPIXEL>$subpixel</SUBPIXEL></opencv_storage>|" \
+            $config > $tmp
+        echo "$(tput setaf 6)--  labels $labels subpixel $subpixel  --$(tput setaf 1)[OK]$(tput sgr0)"
+        echo "labels $labels subpixel $subpixel" >>$log
+        ./bin/lf2depth $tmp | grep -A7 "Ground truth" >>$log
+    done
+done
+rm -f $tmp
+cat $log
+echo "$(tput setaf 3)-------------Finish------------------$(tput sgr0)"
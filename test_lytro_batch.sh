@@ -0,0 +1,11 @@
+echo "$(tput setaf 3)-------------------------------------------$(tput sgr0)"
+echo "$(tput setaf 3)--       LF2DEPTH BATCH (LYTRO)          --$(tput sgr0)"
+echo "$(tput setaf 3)-------------------------------------------$(tput sgr0)"
+
+#usage: ./test_lytro_batch.sh
+#same scenes as test_lytro.sh in one process: the next scene is loaded while the
+#current one computes; per-scene timings go to ./out/batch_summary.txt
+name=$(date '+%y_%m_%d_%s')
+./bin/lf2depth --batch ./config/LYTRO >>./out/$name.txt
+cat ./out/batch_summary.txt
+echo "$(tput setaf 3)-------------Finish------------------$(tput sgr0)"
@@ -0,0 +1,26 @@
+echo "$(tput setaf 3)-------------------------------------------$(tput sgr0)"
+echo "$(tput setaf 3)--       LF2DEPTH COLOUR MODES (LYTRO)   --$(tput sgr0)"
+echo "$(tput setaf 3)-------------------------------------------$(tput sgr0)"
+
+#usage: ./test_lytro_color.sh
+#runs every LYTRO scene with the RGB cost (COLOR_MODE 0), luminance (1) and the
+#two channel opponent cost (2), keeps the timings and the filtered depth of each
+#mode next to the scene output as depth_filter_color<mode>.png
+name=$(date '+%y_%m_%d_%s')
+tmp=./out/color_$name.xml
+log=./out/color_$name.txt
+
+for scene in toymap tulip guitar office bus flower2 squirrel; do
+    for mode in 0 1 2; do
+        sed -e 's|<COLOR_MODE>.*</COLOR_MODE>||' \
+            -e "s|</opencv_storage>|<COLOR_MODE>$mode</COLOR_MODE></opencv_storage>|" \
+            ./config/LYTRO/$scene.xml > $tmp
+        echo "$(tput setaf 6)--  $scene colour mode $mode  --$(tput setaf 1)[OK]$(tput sgr0)"
+        echo "$scene colour mode $mode" >>$log
+        ./bin/lf2depth $tmp | grep -e "Cost kernel" -e "Seconds" >>$log
+        cp ./out/LYTRO/$scene/depth_filter.png ./out/LYTRO/$scene/depth_filter_color$mode.png
+    done
+done
+rm -f $tmp
+cat $log
+echo "$(tput setaf 3)-------------Finish------------------$(tput sgr0)"
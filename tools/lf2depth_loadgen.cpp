@@ -0,0 +1,141 @@
+//  Load generator of the depth service: sends a synthetic light field mosaic to
+//  lf2depth --serve over and over and reports the latency distribution at steady state.
+//
+//  usage: ./bin/lf2depth_loadgen <socket> [-n requests] [-w warmup] [-s W H U V] [-l nlabels] [--shm]
+//         --shm hands the mosaic over as a POSIX shared memory object instead of the socket
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include "../src/lf_protocol.h"
+
+using namespace std;
+
+/**
+    Synthetic mosaic: a textured slanted plane seen from U x V views, BGR,
+    (H*V) x (W*U), disparity from -1.2 to 1.2 pixels per view.
+*/
+void make_mosaic(vector<unsigned char>& m, int W, int H, int U, int V){
+
+    m.resize(size_t(W)*H*U*V*3);
+    for (int v=0; v<V; v++)
+        for (int u=0; u<U; u++)
+            for (int y=0; y<H; y++)
+                for (int x=0; x<W; x++){
+                    float d  = -1.2f + 2.4f*(0.6f*x + 0.4f*y)/W;
+                    float xs = x - d*(u - (U-1)/2);
+                    float ys = y - d*(v - (V-1)/2);
+                    unsigned char* p = &m[((size_t(v)*H + y)*W*U + size_t(u)*W + x)*3];
+                    for (int c=0; c<3; c++){
+                        float t = 128 + 50*sin(0.41f*xs + 0.23f*ys + c) + 35*sin(0.17f*xs - 0.53f*ys + 2*c)
+                                      + 25*sin(1.07f*xs + 0.71f*ys);
+                        p[c] = (unsigned char) min(255.f, max(0.f, t));
+                    }
+                }
+}
+
+int main(int argc, const char* argv[]){
+
+    if (argc<2){
+        printf("usage: %s <socket> [-n requests] [-w warmup] [-s W H U V] [-l nlabels] [--shm]\n", argv[0]);
+        return 1;
+    }
+    int n = 50, warmup = 5, W = 512, H = 512, U = 9, V = 9, nlabels = -1;
+    bool use_shm = false;
+    for (int a=2; a<argc; a++){
+        string o = argv[a];
+        if      ((o=="-n")&&(a+1<argc)) n       = atoi(argv[++a]);
+        else if ((o=="-w")&&(a+1<argc)) warmup  = atoi(argv[++a]);
+        else if ((o=="-l")&&(a+1<argc)) nlabels = atoi(argv[++a]);
+        else if ((o=="-s")&&(a+4<argc)){
+            W = atoi(argv[++a]); H = atoi(argv[++a]);
+            U = atoi(argv[++a]); V = atoi(argv[++a]);
+        }
+        else if (o=="--shm") use_shm = true;
+    }
+
+    vector<unsigned char> mosaic;
+    make_mosaic(mosaic, W, H, U, V);
+
+    lf_request q;
+    memset(&q, 0, sizeof(q));
+    memcpy(q.magic, LF_REQUEST_MAGIC, 4);
+    q.W = W; q.H = H; q.U = U; q.V = V;
+    q.nlabels = nlabels;
+    q.window = q.cost_engine = q.color_mode = q.subpixel = q.threshold = -1;
+    q.lambda = -1;
+    q.bytes  = mosaic.size();
+
+    if (use_shm){
+        snprintf(q.shm, sizeof(q.shm), "/lf2depth_loadgen_%d", int(getpid()));
+        int fd = shm_open(q.shm, O_CREAT|O_RDWR|O_TRUNC, 0600);
+        if ((fd<0)||(ftruncate(fd, mosaic.size())!=0)){
+            printf("cannot create %s\n", q.shm);
+            return 1;
+        }
+        void* p = mmap(NULL, mosaic.size(), PROT_WRITE, MAP_SHARED, fd, 0);
+        memcpy(p, &mosaic[0], mosaic.size());
+        munmap(p, mosaic.size());
+        close(fd);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path)-1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd<0)||(connect(fd, (struct sockaddr*) &addr, sizeof(addr))!=0)){
+        printf("cannot connect to %s\n", argv[1]);
+        return 1;
+    }
+
+    vector<float> maps(size_t(W)*H*2);
+    vector<double> lat, served;
+    for (int r=0; r<warmup+n; r++){
+
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        lf_response a;
+        bool ok = lf_write_full(fd, &q, sizeof(q)) &&
+                  (use_shm || lf_write_full(fd, &mosaic[0], mosaic.size())) &&
+                  lf_read_full(fd, &a, sizeof(a));
+        if (ok&&(a.status==0))
+            ok = lf_read_full(fd, &maps[0], maps.size()*sizeof(float));
+        double s = chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+        if ((!ok)||(a.status!=0)){
+            printf("request %d failed (status %d)\n", r, ok ? a.status : -1);
+            break;
+        }
+        if (r>=warmup){
+            lat.push_back(s);
+            served.push_back(a.seconds);
+        }
+        printf("request %3d %s %.4f s (service %.4f s)\n", r, (r<warmup) ? "warmup" : "      ", s, a.seconds);
+    }
+    close(fd);
+    if (use_shm)
+        shm_unlink(q.shm);
+
+    if (lat.empty())
+        return 1;
+    double total = 0;
+    for (size_t k=0; k<lat.size(); k++) total += lat[k];
+    sort(lat.begin(), lat.end());
+    sort(served.begin(), served.end());
+    size_t m = lat.size();
+    printf("%dx%d, %dx%d views, %s, %zu requests after %d warmup\n", W, H, U, V,
+           use_shm ? "shared memory" : "socket", m, warmup);
+    printf("latency   p50 %.4f s  p99 %.4f s  mean %.4f s  (%.2f requests/s)\n",
+           lat[m/2], lat[min(m-1, size_t(ceil(0.99*m))-1)], total/m, m/total);
+    printf("service   p50 %.4f s  p99 %.4f s\n", served[m/2], served[min(m-1, size_t(ceil(0.99*m))-1)]);
+    return 0;
+}
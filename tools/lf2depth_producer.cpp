@@ -0,0 +1,135 @@
+//  Local producer of the shared-memory frame ring: stands in for a camera capture process,
+//  writes synthetic sub-aperture views into the slots of the ring served by lf2depth --ring
+//  and reports the frame latency distribution at steady state.
+//
+//  usage: ./bin/lf2depth_producer <ring name> [-n frames] [-w warmup] [-s W H U V] [-k slots]
+//         start ./bin/depth --ring <ring name> <config.xml> once the ring exists; with more
+//         than one slot the latency includes the time a frame waits for lf2depth
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include "../src/lf_ring.h"
+
+using namespace std;
+
+/**
+    Synthetic sub-aperture view (u, v): a textured slanted plane, BGR, H x W,
+    disparity from -1.2 to 1.2 pixels per view.
+*/
+void make_view(vector<unsigned char>& m, int W, int H, int U, int V, int u, int v){
+
+    m.resize(size_t(W)*H*3);
+    for (int y=0; y<H; y++)
+        for (int x=0; x<W; x++){
+            float d  = -1.2f + 2.4f*(0.6f*x + 0.4f*y)/W;
+            float xs = x - d*(u - (U-1)/2);
+            float ys = y - d*(v - (V-1)/2);
+            unsigned char* p = &m[(size_t(y)*W + x)*3];
+            for (int c=0; c<3; c++){
+                float t = 128 + 50*sin(0.41f*xs + 0.23f*ys + c) + 35*sin(0.17f*xs - 0.53f*ys + 2*c)
+                              + 25*sin(1.07f*xs + 0.71f*ys);
+                p[c] = (unsigned char) min(255.f, max(0.f, t));
+            }
+        }
+}
+
+int main(int argc, const char* argv[]){
+
+    if (argc<2){
+        printf("usage: %s <ring name> [-n frames] [-w warmup] [-s W H U V] [-k slots]\n", argv[0]);
+        return 1;
+    }
+    int n = 50, warmup = 5, W = 512, H = 512, U = 9, V = 9, slots = 4;
+    for (int a=2; a<argc; a++){
+        string o = argv[a];
+        if      ((o=="-n")&&(a+1<argc)) n      = atoi(argv[++a]);
+        else if ((o=="-w")&&(a+1<argc)) warmup = atoi(argv[++a]);
+        else if ((o=="-k")&&(a+1<argc)) slots  = max(1, atoi(argv[++a]));
+        else if ((o=="-s")&&(a+4<argc)){
+            W = atoi(argv[++a]); H = atoi(argv[++a]);
+            U = atoi(argv[++a]); V = atoi(argv[++a]);
+        }
+    }
+
+    lf_ring_header* h = lf_ring_create(argv[1], W, H, U, V, slots);
+    if (!h){
+        printf("cannot create %s\n", argv[1]);
+        return 1;
+    }
+    printf("ring %s: %d slots of %.1f MB\n", argv[1], slots, h->slot_bytes/1048576.0);
+
+    //the views a camera would decode; only the central row and column are stored
+    vector< vector<unsigned char> > views(U*V);
+    for (int v=0; v<V; v++)
+        for (int u=0; u<U; u++)
+            if ((v==(V-1)/2)||(u==(U-1)/2))
+                make_view(views[v*U+u], W, H, U, V, u, v);
+
+    vector<double> lat, served, fill;
+    int failed = 0;
+    chrono::steady_clock::time_point t_first;
+
+    //collect the outputs of the frame a slot held (frames come back in order)
+    #define COLLECT(s) do { \
+        double l = ((s)->done_ns-(s)->submit_ns)*1e-9; \
+        if ((s)->status!=0) failed++; \
+        else if ((s)->frame>=uint64_t(warmup)){ lat.push_back(l); served.push_back((s)->seconds); } \
+        printf("frame %3d %s %.4f s (lf2depth %.4f s)\n", int((s)->frame), \
+               ((s)->frame<uint64_t(warmup)) ? "warmup" : "      ", l, (s)->seconds); \
+    } while (0)
+
+    for (int f=0; f<warmup+n; f++){
+
+        while (sem_wait(&h->free)!=0)
+            if (errno!=EINTR) return 1;
+        unsigned char* slot = lf_ring_slot_ptr(h, f%slots);
+        lf_ring_slot*  s    = (lf_ring_slot*) slot;
+        if (f>=slots)
+            COLLECT(s);
+        if (f==warmup)
+            t_first = chrono::steady_clock::now();
+
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int v=0; v<V; v++)
+            for (int u=0; u<U; u++)
+                if (!views[v*U+u].empty())
+                    lf_ring_put_view(h, slot, u, v, &views[v*U+u][0]);
+        if (f>=warmup)
+            fill.push_back(chrono::duration<double>(chrono::steady_clock::now()-t0).count());
+        lf_ring_publish(h, slot, f);
+    }
+
+    //drain: every slot comes back once lf2depth has written its outputs
+    for (int k=0; k<slots; k++){
+        while (sem_wait(&h->free)!=0)
+            if (errno!=EINTR) return 1;
+        int f = warmup+n-slots+k;
+        if (f>=0)
+            COLLECT((lf_ring_slot*) lf_ring_slot_ptr(h, f%slots));
+    }
+    double total = chrono::duration<double>(chrono::steady_clock::now()-t_first).count();
+    lf_ring_close(h);
+    lf_ring_detach(h);
+    shm_unlink(argv[1]);
+
+    if (lat.empty())
+        return 1;
+    sort(lat.begin(), lat.end());
+    sort(served.begin(), served.end());
+    sort(fill.begin(), fill.end());
+    size_t m = lat.size();
+    size_t p99 = min(m-1, size_t(ceil(0.99*m))-1);
+    printf("%dx%d, %dx%d views, %d slots, %zu frames after %d warmup, %d failed\n", W, H, U, V,
+           slots, m, warmup, failed);
+    printf("latency   p50 %.4f s  p99 %.4f s  (%.2f frames/s)\n", lat[m/2], lat[p99], m/total);
+    printf("lf2depth  p50 %.4f s  p99 %.4f s\n", served[m/2], served[p99]);
+    printf("fill      p50 %.4f s\n", fill[fill.size()/2]);
+    return failed ? 1 : 0;
+}
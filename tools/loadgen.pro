@@ -0,0 +1,9 @@
+TEMPLATE	= app
+CONFIG		-= qt
+SOURCES		= lf2depth_loadgen.cpp
+HEADERS		= ../src/lf_protocol.h
+TARGET		= lf2depth_loadgen
+QMAKE_CXXFLAGS += -O2 -std=c++11
+LIBS        += -lrt
+OBJECTS_DIR = ../obj/tools
+DESTDIR     = ../bin
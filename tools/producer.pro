@@ -0,0 +1,9 @@
+TEMPLATE	= app
+CONFIG		-= qt
+SOURCES		= lf2depth_producer.cpp
+HEADERS		= ../src/lf_ring.h
+TARGET		= lf2depth_producer
+QMAKE_CXXFLAGS += -O2 -std=c++11
+LIBS        += -pthread -lrt
+OBJECTS_DIR = ../obj/tools
+DESTDIR     = ../bin